@@ -5,7 +5,8 @@ chmod +x bin/toss
 sudo cp bin/toss /usr/local/bin
 mkdir ~/.recyclebin
 
-# setup cron job for automatic file deletion
-croncmd="find ~/recyclebin -mtime +30 -delete;"
+# setup cron job for automatic file deletion, replacing the old find based one
+oldcmd="find ~/recyclebin -mtime +30 -delete;"
+croncmd="/usr/local/bin/toss --purge --older-than 30 > /dev/null;"
 cronjob="0 0 * * * $croncmd"
-( crontab -l | grep -v -F "$croncmd" ; echo "$cronjob" ) | crontab -
\ No newline at end of file
+( crontab -l | grep -v -F "$oldcmd" | grep -v -F "$croncmd" ; echo "$cronjob" ) | crontab -
\ No newline at end of file
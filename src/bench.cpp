@@ -0,0 +1,575 @@
+/**
+ * toss-bench: times a toss binary on synthetic source trees and recycle bins, for `make bench`
+ *
+ * For every directory (by default one on tmpfs and one on disk), workload and size it
+ * 1. generates a source tree of that many files, and a fresh $HOME with its recycle bin next to
+ *    it, so every toss is a rename on one filesystem
+ * 2. runs, in this order: toss (all files through --stdin0), the list modes and --du, recover,
+ *    toss -r and recover -r of the whole tree, then purge after tossing the files once more
+ * 3. reports each run as JSON on stdout: wall time, peak RSS and exit status, and the number of
+ *    syscalls made by toss and all its threads, by name
+ *
+ * Syscalls are counted with ptrace, which slows every syscall down, so the counts come from a
+ * second pass over a regenerated tree and the times only from the first. Trees bigger than
+ * --trace-max files are not traced (x86_64 only).
+ *
+ * --max-syscalls op=N,... makes it a check (`make test` runs one): the syscalls an op makes per
+ * file, the difference between the two smallest traced sizes over the difference in files
+ * (so the fixed startup cost drops out), must be at most N, or toss-bench exits 1.
+ *
+ * Workloads, every file with its own content so that none are deduplicated:
+ *   wide    every file in one directory, 16 to 64 bytes each
+ *   deep    chains of 32 nested directories, one file per level
+ *   tiny    a few bytes each, 256 files per directory, 256 directories per parent
+ *   huge    one file of --huge-mb MB per 10000 files asked for (at least one)
+ *   mixed   100 files per directory: mostly under 1KB, one in ten 4-16KB, one in a hundred 64KB
+ */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <filesystem>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <utility>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <linux/magic.h>
+#if defined(__x86_64__)
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <sys/syscall.h>
+#endif
+
+#include <argparse/argparse.hpp>
+using namespace std;
+using Clock = chrono::steady_clock;
+
+extern char** environ;
+
+struct Options {
+    string toss;
+    vector<size_t> sizes;
+    vector<string> workloads;
+    vector<string> dirs;
+    size_t traceMax;
+    size_t hugeMb;
+    bool keep;
+    map<string, double> maxSyscalls;    // per file, by op
+};
+
+/** Workloads **/
+
+// the same pseudo-random bytes every run, file contents are slices of it
+static const string& noise() {
+    static string bytes;
+    if (bytes.empty()) {
+        bytes.resize(1 << 20);
+        uint64_t state = 0x9e3779b97f4a7c15ULL;
+        for (size_t i = 0; i < bytes.size(); i += 8) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            memcpy(&bytes[i], &state, 8);
+        }
+    }
+    return bytes;
+}
+
+// a file of size bytes whose content starts with its index, so no two are the same
+static void writeFile(const string& path, size_t index, uintmax_t size) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) throw runtime_error("cannot create " + path + ": " + strerror(errno));
+    string head = to_string(index) + "\n";
+    uintmax_t written = 0;
+    while (written < size) {
+        const char* data;
+        size_t length;
+        if (written < head.size()) {
+            data = head.data() + written;
+            length = head.size() - written;
+        } else {
+            size_t offset = (written + index * 4099) % noise().size();
+            data = noise().data() + offset;
+            length = noise().size() - offset;
+        }
+        ssize_t n = write(fd, data, min<uintmax_t>(length, size - written));
+        if (n <= 0) {
+            close(fd);
+            throw runtime_error("cannot write " + path + ": " + strerror(errno));
+        }
+        written += n;
+    }
+    close(fd);
+}
+
+// path of file i relative to the tree, and its size
+static pair<string, uintmax_t> layout(const string& workload, size_t i, size_t hugeBytes) {
+    if (workload == "wide") {
+        return {"f" + to_string(i), 16 + i % 49};
+    } else if (workload == "deep") {
+        string dir = "c" + to_string(i / 32);
+        for (size_t level = 0; level < i % 32; ++level) dir += "/l" + to_string(level);
+        return {dir + "/f" + to_string(i), 16 + i % 241};
+    } else if (workload == "tiny") {
+        size_t dir = i / 256;
+        return {to_string(dir / 256) + "/" + to_string(dir % 256) + "/f" + to_string(i), 0};
+    } else if (workload == "huge") {
+        return {"f" + to_string(i), hugeBytes};
+    } else {
+        size_t dir = i / 100;
+        uintmax_t size = i % 100 == 0 ? 65536 : i % 10 == 0 ? 4096 + (i * 7919) % 12288 : (i * 131) % 1024;
+        return {to_string(dir / 100) + "/" + to_string(dir % 100) + "/f" + to_string(i), size};
+    }
+}
+
+// fill root, and the NUL separated list of its files (relative to root) at list; returns bytes written
+static uintmax_t generate(const Options& options, const string& workload, size_t files, const string& root, const string& list, size_t& count) {
+    count = workload == "huge" ? max<size_t>(1, files / 10000) : files;
+    uintmax_t bytes = 0;
+    string names;
+    string madeDir;
+    filesystem::create_directories(root);
+    for (size_t i = 0; i < count; ++i) {
+        auto [path, size] = layout(workload, i, options.hugeMb << 20);
+        string dir = filesystem::path(path).parent_path().string();
+        if (!dir.empty() && dir != madeDir) {
+            filesystem::create_directories(root + "/" + dir);
+            madeDir = dir;
+        }
+        writeFile(root + "/" + path, i, size);
+        bytes += size;
+        names += path;
+        names += '\0';
+    }
+    ofstream(list, ios::binary) << names;
+    return bytes;
+}
+
+/** Syscall Counting **/
+
+#if defined(__x86_64__)
+#define SYSCALL(name) {SYS_##name, #name}
+static const unordered_map<long, const char*> syscallNames = {
+    SYSCALL(read), SYSCALL(write), SYSCALL(open), SYSCALL(close), SYSCALL(stat), SYSCALL(fstat),
+    SYSCALL(lstat), SYSCALL(newfstatat), SYSCALL(statx), SYSCALL(openat), SYSCALL(lseek),
+    SYSCALL(pread64), SYSCALL(pwrite64), SYSCALL(getdents64), SYSCALL(rename), SYSCALL(renameat),
+    SYSCALL(renameat2), SYSCALL(unlink), SYSCALL(unlinkat), SYSCALL(mkdir), SYSCALL(mkdirat),
+    SYSCALL(rmdir), SYSCALL(fcntl), SYSCALL(flock), SYSCALL(fsync), SYSCALL(fdatasync),
+    SYSCALL(fadvise64), SYSCALL(ioctl), SYSCALL(copy_file_range), SYSCALL(sendfile),
+    SYSCALL(readlink), SYSCALL(readlinkat), SYSCALL(access), SYSCALL(faccessat), SYSCALL(getcwd),
+    SYSCALL(chdir), SYSCALL(mmap), SYSCALL(munmap), SYSCALL(mprotect), SYSCALL(madvise),
+    SYSCALL(brk), SYSCALL(futex), SYSCALL(clone), SYSCALL(execve), SYSCALL(exit),
+    SYSCALL(exit_group), SYSCALL(wait4), SYSCALL(getuid), SYSCALL(geteuid), SYSCALL(getpid),
+    SYSCALL(gettid), SYSCALL(uname), SYSCALL(sysinfo), SYSCALL(rt_sigaction),
+    SYSCALL(rt_sigprocmask), SYSCALL(set_robust_list), SYSCALL(set_tid_address),
+    SYSCALL(arch_prctl), SYSCALL(prlimit64), SYSCALL(sched_getaffinity), SYSCALL(sched_yield),
+    SYSCALL(getrandom), SYSCALL(clock_gettime), SYSCALL(clock_nanosleep), SYSCALL(poll),
+    SYSCALL(socket), SYSCALL(connect), SYSCALL(io_uring_setup), SYSCALL(io_uring_enter),
+    SYSCALL(io_uring_register), SYSCALL(inotify_init1), SYSCALL(inotify_add_watch),
+    SYSCALL(ftruncate), SYSCALL(fallocate), SYSCALL(fchmod), SYSCALL(utimensat), SYSCALL(link),
+    SYSCALL(symlink), SYSCALL(pipe2), SYSCALL(dup2),
+#ifdef SYS_clone3
+    SYSCALL(clone3),
+#endif
+#ifdef SYS_rseq
+    SYSCALL(rseq),
+#endif
+#ifdef SYS_faccessat2
+    SYSCALL(faccessat2),
+#endif
+};
+#undef SYSCALL
+
+static string syscallName(long number) {
+    auto it = syscallNames.find(number);
+    return it != syscallNames.end() ? it->second : "syscall_" + to_string(number);
+}
+#endif
+
+/** Running Toss **/
+
+struct Run {
+    string op;
+    double seconds = 0;
+    long peakRssKb = 0;
+    int status = 0;
+    bool traced = false;
+    map<string, long> syscalls;
+};
+
+// follow child (stopped before exec) and every thread and process it starts until it exits
+static int traceChild(pid_t child, Run& run) {
+#if defined(__x86_64__)
+    int status;
+    waitpid(child, &status, 0);
+    if (!WIFSTOPPED(status)) return status;     // ptrace not allowed here, ran untraced
+    ptrace(PTRACE_SETOPTIONS, child, 0, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_EXITKILL);
+    ptrace(PTRACE_SYSCALL, child, 0, 0);
+
+    // syscall stops alternate between entry and exit, only entries are counted
+    unordered_map<pid_t, bool> inSyscall;
+    int result = 0;
+    for (;;) {
+        pid_t pid = waitpid(-1, &status, __WALL);
+        if (pid < 0) break;
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            inSyscall.erase(pid);
+            if (pid == child) result = status;
+            continue;
+        }
+        int signal = 0;
+        int stop = WSTOPSIG(status);
+        if (stop == (SIGTRAP | 0x80)) {
+            bool& entering = inSyscall.emplace(pid, false).first->second;
+            if (!entering) {
+                struct user_regs_struct regs;
+                if (ptrace(PTRACE_GETREGS, pid, 0, &regs) == 0) ++run.syscalls[syscallName(regs.orig_rax)];
+            }
+            entering = !entering;
+        } else if ((status >> 16) == 0 && stop != SIGTRAP && stop != SIGSTOP) {
+            signal = stop;
+        }
+        ptrace(PTRACE_SYSCALL, pid, 0, signal);
+    }
+    run.traced = true;
+    return result;
+#else
+    int status;
+    waitpid(child, &status, 0);
+    return status;
+#endif
+}
+
+// run toss with args from cwd, stdin from input ("" for /dev/null) and its output discarded
+static Run runToss(const Options& options, const string& op, const vector<string>& args, const string& cwd, const string& home, const string& input, bool trace) {
+    vector<string> env;
+    for (char** var = environ; *var != nullptr; ++var) {
+        if (strncmp(*var, "HOME=", 5) != 0) env.push_back(*var);
+    }
+    env.push_back("HOME=" + home);
+    vector<char*> argv{const_cast<char*>(options.toss.c_str())};
+    for (const auto& arg: args) argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+    vector<char*> envp;
+    for (auto& var: env) envp.push_back(var.data());
+    envp.push_back(nullptr);
+
+    Run run;
+    run.op = op;
+    auto start = Clock::now();
+    pid_t child = fork();
+    if (child < 0) throw runtime_error(string("cannot fork: ") + strerror(errno));
+    if (child == 0) {
+        int in = open(input.empty() ? "/dev/null" : input.c_str(), O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+        if (in < 0 || out < 0 || dup2(in, 0) < 0 || dup2(out, 1) < 0 || chdir(cwd.c_str()) != 0) _exit(127);
+#if defined(__x86_64__)
+        if (trace && ptrace(PTRACE_TRACEME, 0, 0, 0) == 0) raise(SIGSTOP);
+#endif
+        execve(argv[0], argv.data(), envp.data());
+        _exit(127);
+    }
+
+    int status;
+    if (trace) {
+        status = traceChild(child, run);
+    } else {
+        struct rusage usage;
+        wait4(child, &status, 0, &usage);
+        run.peakRssKb = usage.ru_maxrss;
+    }
+    run.seconds = chrono::duration<double>(Clock::now() - start).count();
+    run.status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    return run;
+}
+
+/** Benchmarks **/
+
+struct Result {
+    string dir;
+    string fs;
+    string workload;
+    size_t files;
+    uintmax_t bytes;
+    Run run;
+};
+
+// one pass over a fresh tree and bin: every op in order
+static vector<Run> runPass(const Options& options, const string& base, const string& workload, size_t files, bool trace, size_t& count, uintmax_t& bytes) {
+    string root = base + "/tree";
+    string home = base + "/home";
+    string list = base + "/list";
+    filesystem::remove_all(root);
+    filesystem::remove_all(home);
+    filesystem::create_directories(home);
+    bytes = generate(options, workload, files, root, list, count);
+
+    vector<Run> runs;
+    auto step = [&](const string& op, const vector<string>& args, const string& cwd, const string& input = "") {
+        cerr << "  " << op << (trace ? " (counting syscalls)" : "") << endl;
+        runs.push_back(runToss(options, op, args, cwd, home, input, trace));
+    };
+    step("toss", {"--stdin0"}, root, list);
+    step("list-recent", {"--list"}, root);
+    step("list-name", {"--list-name"}, root);
+    step("list-size", {"--list-size"}, root);
+    step("list-recent-limit", {"--list", "--limit", "20"}, root);
+    step("list-json", {"--list", "--format", "json"}, root);
+    step("du", {"--du", root}, root);
+    step("recover", {"--recover", "--force", "--stdin0"}, root, list);
+    step("toss-recursive", {"--recursive", root}, base);
+    step("recover-recursive", {"--recover", "--recursive", root}, base);
+    runToss(options, "toss", {"--stdin0"}, root, home, list, false);
+    step("purge", {"--purge", "--older-than", "0"}, root);
+    return runs;
+}
+
+static string fsName(const string& dir) {
+    struct statfs info;
+    if (statfs(dir.c_str(), &info) != 0) return "unknown";
+    return info.f_type == TMPFS_MAGIC ? "tmpfs" : "disk";
+}
+
+static string jsonString(const string& text) {
+    string out = "\"";
+    for (char c: text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+static void printJson(const Options& options, const vector<Result>& results) {
+    struct utsname host;
+    uname(&host);
+    ostringstream out;
+    out << "{\n  \"toss\": " << jsonString(options.toss)
+        << ",\n  \"host\": {\"cpus\": " << sysconf(_SC_NPROCESSORS_ONLN) << ", \"kernel\": " << jsonString(host.release) << "}"
+        << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& result = results[i];
+        const Run& run = result.run;
+        out << (i == 0 ? "\n" : ",\n")
+            << "    {\"dir\": " << jsonString(result.dir) << ", \"fs\": " << jsonString(result.fs)
+            << ", \"workload\": " << jsonString(result.workload) << ", \"files\": " << result.files
+            << ", \"bytes\": " << result.bytes << ", \"op\": " << jsonString(run.op)
+            << ", \"seconds\": " << fixed << setprecision(6) << run.seconds
+            << ", \"peak_rss_kb\": " << run.peakRssKb << ", \"exit\": " << run.status << ", \"syscalls\": ";
+        if (!run.traced) {
+            out << "null";
+        } else {
+            long total = 0;
+            for (const auto& count: run.syscalls) total += count.second;
+            out << "{\"total\": " << total;
+            for (const auto& count: run.syscalls) out << ", " << jsonString(count.first) << ": " << count.second;
+            out << "}";
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+    cout << out.str();
+}
+
+// the --max-syscalls limits against every directory and workload measured, false if one is over
+static bool checkSyscalls(const Options& options, const vector<Result>& results) {
+    bool passed = true;
+    for (const auto& limit: options.maxSyscalls) {
+        // totals of the op by directory and workload, then by number of files
+        map<pair<string, string>, map<size_t, long>> totals;
+        for (const auto& result: results) {
+            if (result.run.op != limit.first || !result.run.traced) continue;
+            long total = 0;
+            for (const auto& count: result.run.syscalls) total += count.second;
+            totals[{result.dir, result.workload}][result.files] = total;
+        }
+        if (totals.empty()) {
+            // ptrace is not allowed everywhere (some containers), that is no reason to fail
+            cerr << "toss-bench: " << limit.first << " was not traced, syscalls not checked" << endl;
+            continue;
+        }
+        for (const auto& measured: totals) {
+            if (measured.second.size() < 2) {
+                cerr << "toss-bench error: --max-syscalls needs two traced sizes" << endl;
+                return false;
+            }
+            auto small = measured.second.begin();
+            auto large = next(small);
+            double perFile = double(large->second - small->second) / double(large->first - small->first);
+            bool over = perFile > limit.second;
+            cerr << "toss-bench: " << limit.first << " makes " << fixed << setprecision(2) << perFile
+                 << " syscalls per file (" << measured.first.second << " on " << measured.first.first
+                 << "), at most " << limit.second << (over ? " allowed: FAILED" : " allowed") << endl;
+            passed = passed && !over;
+        }
+    }
+    return passed;
+}
+
+// a tmpfs directory and a disk one, whichever exist
+static vector<string> defaultDirs() {
+    vector<string> dirs;
+    if (fsName("/dev/shm") == "tmpfs") dirs.push_back("/dev/shm");
+    const char* tmp = getenv("TMPDIR");
+    for (string dir: {tmp != nullptr ? string(tmp) : string(), string("/var/tmp"), string("/tmp")}) {
+        if (!dir.empty() && access(dir.c_str(), W_OK) == 0 && fsName(dir) == "disk") {
+            dirs.push_back(dir);
+            break;
+        }
+    }
+    return dirs;
+}
+
+static vector<string> splitList(const string& text) {
+    vector<string> items;
+    stringstream in(text);
+    string item;
+    while (getline(in, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser program("toss-bench");
+
+    program.add_argument("--toss")
+        .help("toss binary to measure (default: the one next to toss-bench)");
+
+    program.add_argument("--sizes")
+        .help("comma separated numbers of files per tree")
+        .default_value(string("10000,100000,1000000"));
+
+    program.add_argument("--workloads")
+        .help("comma separated workloads: wide, deep, tiny, huge, mixed")
+        .default_value(string("wide,deep,tiny,huge,mixed"));
+
+    program.add_argument("--dir")
+        .help("directory to generate trees and bins in, may be repeated (default: /dev/shm and a disk one)")
+        .default_value(vector<string>{})
+        .append();
+
+    program.add_argument("--trace-max")
+        .help("count syscalls for trees of up to this many files, 0 for never")
+        .default_value(100000)
+        .scan<'i', int>();
+
+    program.add_argument("--huge-mb")
+        .help("size of each file of the huge workload, in MB")
+        .default_value(64)
+        .scan<'i', int>();
+
+    program.add_argument("--max-syscalls")
+        .help("comma separated op=N: fail if an op makes more than N syscalls per file (needs two traced sizes)");
+
+    program.add_argument("--keep")
+        .help("leave the generated trees and bins behind")
+        .default_value(false)
+        .implicit_value(true);
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        cerr << err.what() << endl;
+        cerr << program;
+        exit(1);
+    }
+
+    Options options;
+    if (auto toss = program.present("--toss")) {
+        options.toss = filesystem::absolute(*toss).string();
+    } else {
+        options.toss = (filesystem::read_symlink("/proc/self/exe").parent_path() / "toss").string();
+    }
+    for (const auto& size: splitList(program.get<string>("--sizes"))) options.sizes.push_back(stoull(size));
+    options.workloads = splitList(program.get<string>("--workloads"));
+    options.dirs = program.get<vector<string>>("--dir");
+    if (options.dirs.empty()) options.dirs = defaultDirs();
+    options.traceMax = max(0, program.get<int>("--trace-max"));
+    options.hugeMb = max(1, program.get<int>("--huge-mb"));
+    options.keep = program["--keep"] == true;
+    if (auto limits = program.present("--max-syscalls")) {
+        for (const auto& limit: splitList(*limits)) {
+            size_t equals = limit.find('=');
+            if (equals == string::npos) {
+                cerr << "toss-bench error: --max-syscalls takes op=N, not " << limit << endl;
+                exit(1);
+            }
+            options.maxSyscalls[limit.substr(0, equals)] = stod(limit.substr(equals + 1));
+        }
+    }
+
+    if (access(options.toss.c_str(), X_OK) != 0) {
+        cerr << "toss-bench error: cannot run " << options.toss << endl;
+        exit(1);
+    }
+    for (const auto& workload: options.workloads) {
+        if (workload != "wide" && workload != "deep" && workload != "tiny" && workload != "huge" && workload != "mixed") {
+            cerr << "toss-bench error: unknown workload " << workload << endl;
+            exit(1);
+        }
+    }
+
+    vector<Result> results;
+    bool failed = false;
+    try {
+        for (const auto& dir: options.dirs) {
+            string pattern = dir + "/toss-bench.XXXXXX";
+            if (mkdtemp(pattern.data()) == nullptr) throw runtime_error("cannot create a directory in " + dir + ": " + strerror(errno));
+            string base = pattern;
+            string fs = fsName(base);
+
+            for (const auto& workload: options.workloads) {
+                for (size_t files: options.sizes) {
+                    cerr << workload << ", " << files << " files, on " << fs << " (" << base << ")" << endl;
+                    size_t count;
+                    uintmax_t bytes;
+                    vector<Run> runs = runPass(options, base, workload, files, false, count, bytes);
+                    if (count <= options.traceMax) {
+                        size_t tracedCount;
+                        uintmax_t tracedBytes;
+                        vector<Run> traced = runPass(options, base, workload, files, true, tracedCount, tracedBytes);
+                        for (size_t i = 0; i < runs.size(); ++i) {
+                            runs[i].syscalls = move(traced[i].syscalls);
+                            runs[i].traced = traced[i].traced;
+                        }
+                    }
+                    for (auto& run: runs) {
+                        failed = failed || run.status != 0;
+                        results.push_back({dir, fs, workload, count, bytes, move(run)});
+                    }
+                }
+            }
+            if (!options.keep) filesystem::remove_all(base);
+        }
+    } catch (const exception& err) {
+        cerr << "toss-bench error: " << err.what() << endl;
+        printJson(options, results);
+        exit(1);
+    }
+
+    printJson(options, results);
+    if (failed) cerr << "toss-bench: some toss runs failed, see \"exit\" in the results" << endl;
+    if (!checkSyscalls(options, results)) failed = true;
+    return failed ? 1 : 0;
+}
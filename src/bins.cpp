@@ -0,0 +1,141 @@
+#include "bins.hpp"
+#include "toss.hpp"
+
+#include <filesystem>
+#include <algorithm>
+#include <fstream>
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+string mountRoot(const string& path) {
+    error_code ec;
+    filesystem::path current = filesystem::weakly_canonical(path, ec);
+    if (ec) current = path;
+
+    struct stat info;
+    if (stat(current.c_str(), &info) != 0) return "/";
+
+    // climb until the parent is on a different device
+    while (current.has_relative_path()) {
+        filesystem::path parent = current.parent_path();
+        struct stat parentInfo;
+        if (stat(parent.c_str(), &parentInfo) != 0 || parentInfo.st_dev != info.st_dev) break;
+        current = parent;
+    }
+    return current.string();
+}
+
+BinRegistry::BinRegistry(const string& homeBin):homeBin(homeBin), binName("/.recyclebin-" + to_string(getuid())) {
+    struct stat info;
+    if (stat(homeBin.c_str(), &info) != 0) {
+        throw toss_exception("cannot stat recycle bin " + homeBin + ": " + strerror(errno));
+    }
+    homeDevice = info.st_dev;
+    bins.push_back(homeBin);
+    byDevice[homeDevice] = homeBin;
+
+    // bins on other mounts from earlier tosses, skipping any that have since gone away
+    ifstream registry(metaPath(homeBin, "bins"));
+    string bin;
+    while (getline(registry, bin)) {
+        if (bin.empty() || find_if(bins.begin(), bins.end(), [&](const string& b) { return b == bin; }) != bins.end()) continue;
+        if (stat(bin.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) continue;
+        bins.push_back(bin);
+        byDevice.emplace(info.st_dev, bin);
+    }
+}
+
+void BinRegistry::registerBin(const string& bin) {
+    if (std::find(bins.begin(), bins.end(), bin) != bins.end()) return;
+    bins.push_back(bin);
+
+    ensureMetaDir(homeBin);
+    string registryPath = metaPath(homeBin, "bins");
+    int fd = open(registryPath.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        throw toss_exception("cannot open " + registryPath + ": " + strerror(errno));
+    }
+    string line = bin + "\n";
+    ssize_t n = write(fd, line.data(), line.size());
+    close(fd);
+    if (n != (ssize_t)line.size()) {
+        throw toss_exception("cannot write " + registryPath + ": " + strerror(errno));
+    }
+}
+
+const string& BinRegistry::binFor(const string& path) {
+    // the directory entry being moved lives in the parent, so that decides the device
+    string parent = filesystem::path(path).parent_path().string();
+    if (lastBin != nullptr && parent == lastParent) return *lastBin;
+    struct stat info;
+    if (stat(parent.empty() ? "/" : parent.c_str(), &info) != 0) return homeBin;
+
+    auto it = byDevice.find(info.st_dev);
+    if (it != byDevice.end()) {
+        lastParent = move(parent);
+        lastBin = &it->second;
+        return it->second;
+    }
+
+    string root = mountRoot(parent);
+    string bin = (root == "/" ? "" : root) + binName;
+
+    // only trust a bin we own on the same device, anyone could have created the name first
+    struct stat binInfo;
+    bool usable = (mkdir(bin.c_str(), S_IRWXU) == 0 || errno == EEXIST)
+        && lstat(bin.c_str(), &binInfo) == 0
+        && S_ISDIR(binInfo.st_mode)
+        && binInfo.st_uid == getuid()
+        && binInfo.st_dev == info.st_dev;
+    if (!usable) {
+        return byDevice.emplace(info.st_dev, homeBin).first->second;
+    }
+
+    registerBin(bin);
+    return byDevice.emplace(info.st_dev, bin).first->second;
+}
+
+string BinRegistry::find(const string& original) {
+    // the bin on the original's filesystem is the likeliest, check it first
+    filesystem::path existing = original;
+    struct stat info;
+    while (existing.has_relative_path() && stat(existing.c_str(), &info) != 0) {
+        existing = existing.parent_path();
+    }
+    string likely = homeBin;
+    if (stat(existing.c_str(), &info) == 0) {
+        auto it = byDevice.find(info.st_dev);
+        if (it != byDevice.end()) likely = it->second;
+    }
+    if (lstat((likely + original).c_str(), &info) == 0) return likely;
+
+    for (const auto& bin: bins) {
+        if (bin != likely && lstat((bin + original).c_str(), &info) == 0) return bin;
+    }
+    return likely;
+}
+
+bool BinRegistry::isBinPath(const string& path) const {
+    for (const auto& bin: bins) {
+        if (startsWith(path, bin) && (path.size() == bin.size() || path[bin.size()] == '/')) return true;
+    }
+    size_t at = path.find(binName);
+    return at != string::npos && (at + binName.size() == path.size() || path[at + binName.size()] == '/');
+}
+
+Catalog& BinRegistry::catalogFor(const string& bin) {
+    auto& catalog = catalogs[bin];
+    if (!catalog) catalog = make_unique<Catalog>(bin);
+    return *catalog;
+}
+
+void BinRegistry::flush(bool durable) {
+    for (auto& catalog: catalogs) catalog.second->flush(durable);
+}
+
+void BinRegistry::unlockShards() {
+    for (auto& catalog: catalogs) catalog.second->unlockShards();
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <sys/types.h>
+
+#include "catalog.hpp"
+
+/**
+ * Registry of the recycle bins a user has, so a toss never has to cross a device boundary.
+ * - the home bin (~/.recyclebin) takes everything on the home filesystem
+ * - any other filesystem gets its own bin at <mount root>/.recyclebin-<uid>, created on first toss
+ * - every bin in use is listed in ~/.recyclebin/.toss/bins so list and recover see one logical bin
+ * If a bin cannot be created on a mount (read-only, no permission) the home bin is used instead.
+ */
+class BinRegistry {
+private:
+    std::string homeBin;
+    dev_t homeDevice;
+    std::vector<std::string> bins;
+    std::unordered_map<dev_t, std::string> byDevice;
+    // paths usually arrive grouped by directory, so the last parent looked up is cached
+    std::string lastParent;
+    const std::string* lastBin = nullptr;
+    std::map<std::string, std::unique_ptr<Catalog>> catalogs;
+    // "/.recyclebin-<uid>", the name of this user's bins on other mounts
+    std::string binName;
+
+    void registerBin(const std::string& bin);
+
+public:
+    BinRegistry(const std::string& homeBin);
+
+    const std::string& home() const { return homeBin; }
+
+    // bin on the same filesystem as path, which must exist
+    const std::string& binFor(const std::string& path);
+
+    // bin currently holding original, or the bin it would be tossed to if none does
+    std::string find(const std::string& original);
+
+    // every registered bin that still exists, home bin first
+    const std::vector<std::string>& all() const { return bins; }
+
+    // true if path is, or is inside, one of the bins
+    bool isBinPath(const std::string& path) const;
+
+    Catalog& catalogFor(const std::string& bin);
+    void flush(bool durable = false);
+
+    // release the shard locks taken through every bin's catalog
+    void unlockShards();
+};
+
+// root directory of the filesystem path lives on
+std::string mountRoot(const std::string& path);
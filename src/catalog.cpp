@@ -0,0 +1,821 @@
+#include "catalog.hpp"
+#include "toss.hpp"
+#include "scanner.hpp"
+#include "stats.hpp"
+
+#include <filesystem>
+#include <unordered_map>
+#include <cstdio>
+#include <climits>
+#include <set>
+#include <algorithm>
+#include <iterator>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+static void writeAll(int fd, const string& data, const string& path) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw toss_exception("failed to write catalog " + path + ": " + strerror(errno));
+        }
+        done += n;
+    }
+}
+
+static string readAll(const string& path) {
+    string data;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) return data;
+        throw toss_exception("failed to open catalog " + path + ": " + strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0) data.reserve(st.st_size);
+    char buf[1 << 16];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            throw toss_exception("failed to read catalog " + path + ": " + strerror(errno));
+        }
+        data.append(buf, n);
+    }
+    close(fd);
+    return data;
+}
+
+// identifies a live entry: the same stored object can be live under several original paths
+static string keyOf(const string& stored, const string& original) {
+    string key;
+    key.reserve(stored.size() + original.size() + 1);
+    key += stored;
+    key += '\0';
+    key += original;
+    return key;
+}
+
+// split a record into its 6 tab separated fields, false if it is not a well formed record;
+// fields[6] is the optional metadata field (nullptr without), the others keep their places
+static bool splitRecord(const char* p, const char* eol, const char* fields[7]) {
+    int count = 0;
+    fields[count++] = p;
+    for (const char* c = p; c < eol && count < 7; ++c) {
+        if (*c == '\t') fields[count++] = c + 1;
+    }
+    if (count == 7) {
+        rotate(fields + 4, fields + 5, fields + 7);
+    } else {
+        fields[6] = nullptr;
+    }
+    return (count == 6 || count == 7) && (*p == '+' || *p == '-' || *p == '=');
+}
+
+static void appendTime(string& out, const struct timespec& time) {
+    char nsec[16];
+    snprintf(nsec, sizeof(nsec), ".%09ld", (long)time.tv_nsec);
+    out += to_string((long long)time.tv_sec);
+    out += nsec;
+}
+
+static void readTime(const char*& p, struct timespec& time) {
+    char* next;
+    time.tv_sec = strtoll(p, &next, 10);
+    time.tv_nsec = *next == '.' ? strtol(next + 1, &next, 10) : 0;
+    p = *next == ':' ? next + 1 : next;
+}
+
+// fill entry from a split record, reusing the buffers of its paths
+static void readEntry(const char* const fields[7], const char* eol, CatalogEntry& entry) {
+    entry.type = *fields[1];
+    entry.toss_time = strtol(fields[2], nullptr, 10);
+    entry.size = strtoull(fields[3], nullptr, 10);
+    entry.original.clear();
+    unescapeField(entry.original, fields[4], fields[5] - 1);
+    entry.stored.clear();
+    unescapeField(entry.stored, fields[5], eol);
+
+    entry.mode = 0;
+    if (fields[6] != nullptr) {
+        char* next;
+        entry.mode = strtoul(fields[6], &next, 8);
+        entry.uid = strtoul(next + 1, &next, 10);
+        entry.gid = strtoul(next + 1, &next, 10);
+        const char* p = next + 1;
+        readTime(p, entry.atime);
+        readTime(p, entry.mtime);
+    }
+}
+
+Catalog::Catalog(const string& recycledir):recycledir(recycledir), catalogPath(metaPath(recycledir, "catalog")), versionsPath(metaPath(recycledir, "versions")), usagePath(metaPath(recycledir, "usage")), headPath(metaPath(recycledir, "head")), locks(recycledir), rollup(recycledir){}
+
+Catalog::~Catalog() {
+    try {
+        flush();
+    } catch (const toss_exception&) {}
+}
+
+bool Catalog::exists() const {
+    return access(catalogPath.c_str(), F_OK) == 0;
+}
+
+void Catalog::append(char op, const CatalogEntry& entry) {
+    if (indexed) {
+        if (op != '-') index.insert_or_assign(keyOf(entry.stored, entry.original), entry);
+        else index.erase(keyOf(entry.stored, entry.original));
+    }
+
+    size_t start = pending.size();
+    pending += op;
+    pending += '\t';
+    pending += entry.type;
+    pending += '\t';
+    pending += to_string(entry.toss_time);
+    pending += '\t';
+    pending += to_string(entry.size);
+    pending += '\t';
+    if (op != '-' && entry.mode != 0) {
+        char mode[16];
+        snprintf(mode, sizeof(mode), "%o:", (unsigned)entry.mode);
+        pending += mode;
+        pending += to_string(entry.uid);
+        pending += ':';
+        pending += to_string(entry.gid);
+        pending += ':';
+        appendTime(pending, entry.atime);
+        pending += ':';
+        appendTime(pending, entry.mtime);
+        pending += '\t';
+    }
+    escapeField(pending, entry.original);
+    pending += '\t';
+    escapeField(pending, entry.stored);
+    pending += '\n';
+
+    // the store's entries cannot be told from its objects and trees: their records are also
+    // copied to the versions log, for rebuild()
+    if (startsWith(entry.stored, string("/") + META_DIR + "/")) pendingVersions.append(pending, start, string::npos);
+}
+
+// an entry's bytes and item count changed, for the usage total and the directory totals
+void Catalog::account(const CatalogEntry& entry, long long bytes, long long items) {
+    usageDelta += bytes;
+    rollup.count(entry, bytes, items);
+}
+
+void Catalog::ensureIndex() {
+    if (indexed) return;
+    if (scope.empty()) {
+        for (auto& entry: load()) {
+            string key = keyOf(entry.stored, entry.original);
+            index.emplace(move(key), move(entry));
+        }
+    } else {
+        CatalogTail entries = tail();
+        entries.restrict(scope, true);
+        for (CatalogEntry entry; entries.next(entry); ) {
+            string key = keyOf(entry.stored, entry.original);
+            index.emplace(move(key), move(entry));
+        }
+    }
+    indexed = true;
+}
+
+void Catalog::recordToss(const CatalogEntry& entry, bool replaces, bool late) {
+    if (replaces) {
+        ensureIndex();
+        auto it = index.find(keyOf(entry.stored, entry.original));
+        if (it != index.end()) account(it->second, -(long long)it->second.size, -1);
+    }
+    account(entry, entry.size, 1);
+    append(late ? '=' : '+', entry);
+}
+
+void Catalog::recordRecover(const CatalogEntry& entry) {
+    ensureIndex();
+    bool live = index.count(keyOf(entry.stored, entry.original)) > 0;
+    account(entry, -(long long)entry.size, live ? -1 : 0);
+
+    // the size of a recovered directory already covers everything below it
+    if (entry.type == 'd') dropNested(entry.stored, true);
+
+    // a file recovered out of a directory entry shrinks that entry
+    if (!live) {
+        string parent = entry.stored;
+        for (size_t slash; (slash = parent.rfind('/')) != string::npos && slash > 0; ) {
+            parent.erase(slash);
+            string prefix = parent + '\0';
+            auto it = index.lower_bound(prefix);
+            if (it != index.end() && startsWith(it->first, prefix) && it->second.type == 'd') {
+                CatalogEntry shrunk = it->second;
+                shrunk.size -= min(shrunk.size, entry.size);
+                append('=', shrunk);
+                break;
+            }
+        }
+    }
+    append('-', entry);
+}
+
+void Catalog::refresh(const vector<string>& stored) {
+    index.clear();
+    indexed = false;
+    scope = stored;
+}
+
+bool Catalog::contains(const CatalogEntry& entry) {
+    ensureIndex();
+    auto it = index.find(keyOf(entry.stored, entry.original));
+    return it != index.end() && it->second.toss_time == entry.toss_time;
+}
+
+size_t Catalog::references(const string& stored) {
+    ensureIndex();
+    string prefix = stored + '\0';
+    size_t count = 0;
+    for (auto it = index.lower_bound(prefix); it != index.end() && startsWith(it->first, prefix); ++it) {
+        ++count;
+    }
+    return count;
+}
+
+void Catalog::recordPurge(const CatalogEntry& entry) {
+    account(entry, -(long long)entry.size, -1);
+    append('-', entry);
+}
+
+void Catalog::dropNested(const string& stored, bool covered) {
+    ensureIndex();
+    string prefix = stored + "/";
+    vector<CatalogEntry> nested;
+    for (auto it = index.lower_bound(prefix); it != index.end() && startsWith(it->first, prefix); ++it) {
+        nested.push_back(it->second);
+    }
+    for (const auto& entry: nested) {
+        account(entry, covered ? 0 : -(long long)entry.size, -1);
+        append('-', entry);
+    }
+}
+
+void Catalog::flush(bool durable) {
+    if (pending.empty()) return;
+    Phase phase("catalog flush");
+    statsCount("catalog bytes written", pending.size());
+    long long delta = usageDelta;
+    usageDelta = 0;
+
+    // a single O_APPEND write per batch keeps records from concurrent tosses whole; the shared
+    // lock only keeps a rewrite from swapping the file out from under the append
+    ensureMetaDir(recycledir);
+    auto guard = locks.catalogShared();
+    int fd = open(catalogPath.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw toss_exception("failed to open catalog " + catalogPath + ": " + strerror(errno));
+    }
+    string data;
+    data.swap(pending);
+    try {
+        writeAll(fd, data, catalogPath);
+        if (durable && fdatasync(fd) != 0) {
+            throw toss_exception("failed to sync catalog " + catalogPath + ": " + strerror(errno));
+        }
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+
+    // without a usage file the next usage() call totals the catalog, which now includes this batch
+    auto usageGuard = locks.usage();
+    if (delta != 0 && access(usagePath.c_str(), F_OK) == 0) {
+        long long bytes = strtoll(readAll(usagePath).c_str(), nullptr, 10) + delta;
+        writeUsage(bytes < 0 ? 0 : bytes);
+    }
+    rollup.apply();
+
+    if (pendingVersions.empty()) return;
+    data.clear();
+    data.swap(pendingVersions);
+    fd = open(versionsPath.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw toss_exception("failed to open catalog " + versionsPath + ": " + strerror(errno));
+    }
+    try {
+        writeAll(fd, data, versionsPath);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+}
+
+// write a small bookkeeping file beside the catalog and swap it in
+static void replaceFile(const string& path, const string& data) {
+    string tmpPath = path + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw toss_exception("failed to create " + tmpPath + ": " + strerror(errno));
+    }
+    try {
+        writeAll(fd, data, tmpPath);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+        throw toss_exception("failed to replace " + path + ": " + strerror(errno));
+    }
+}
+
+void Catalog::writeUsage(uintmax_t bytes) {
+    replaceFile(usagePath, to_string(bytes) + "\n");
+}
+
+uintmax_t Catalog::usage() {
+    flush();
+    string data = readAll(usagePath);
+    if (!data.empty()) return strtoull(data.c_str(), nullptr, 10);
+
+    uintmax_t bytes = 0;
+    for (const auto& entry: load()) bytes += entry.size;
+    ensureMetaDir(recycledir);
+    auto guard = locks.usage();
+    writeUsage(bytes);
+    return bytes;
+}
+
+// the live entries of a log, oldest toss first
+static vector<CatalogEntry> replay(const string& data) {
+    vector<CatalogEntry> entries;
+    vector<bool> live;
+    unordered_map<string, size_t> index;
+
+    const char* p = data.data();
+    const char* end = p + data.size();
+    while (p < end) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (eol == nullptr) break;   // torn final record from an interrupted write
+
+        const char* fields[7];
+        if (splitRecord(p, eol, fields)) {
+            CatalogEntry entry;
+            readEntry(fields, eol, entry);
+            string key = keyOf(entry.stored, entry.original);
+
+            // an update keeps its place, a new toss of the same path moves to the end so
+            // entries stay in toss order
+            auto it = index.find(key);
+            if (*p != '-') {
+                if (it != index.end() && entries[it->second].toss_time == entry.toss_time) {
+                    entries[it->second] = move(entry);
+                } else {
+                    if (it != index.end()) live[it->second] = false;
+                    index[key] = entries.size();
+                    entries.push_back(move(entry));
+                    live.push_back(true);
+                }
+            } else if (it != index.end()) {
+                live[it->second] = false;
+                index.erase(it);
+            }
+        }
+        p = eol + 1;
+    }
+
+    // drop recovered entries
+    size_t kept = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (live[i]) {
+            if (kept != i) entries[kept] = move(entries[i]);
+            ++kept;
+        }
+    }
+    entries.erase(entries.begin() + kept, entries.end());
+    return entries;
+}
+
+vector<CatalogEntry> Catalog::load() {
+    flush();
+    Phase phase("load catalog");
+    if (!exists()) rebuild();
+    return replay(readAll(catalogPath));
+}
+
+CatalogTail Catalog::tail() {
+    flush();
+    if (!exists()) rebuild();
+    return CatalogTail(catalogPath);
+}
+
+CatalogHead Catalog::head() {
+    flush();
+    if (!exists()) rebuild();
+
+    // "<device> <inode> <offset>" of the log the last settleHead() read
+    unsigned long long device = 0, inode = 0, offset = 0;
+    string saved = readAll(headPath);
+    if (sscanf(saved.c_str(), "%llu %llu %llu", &device, &inode, &offset) != 3) offset = 0;
+    return CatalogHead(catalogPath, device, inode, offset);
+}
+
+void Catalog::settleHead(const CatalogHead& records) {
+    if (records.offset() == 0) return;
+    auto guard = locks.usage();
+    replaceFile(headPath, to_string(records.logDevice()) + " " + to_string(records.logInode()) + " " + to_string(records.offset()) + "\n");
+}
+
+bool Catalog::current(CatalogEntry& entry) {
+    ensureIndex();
+    auto it = index.find(keyOf(entry.stored, entry.original));
+    if (it == index.end() || it->second.toss_time != entry.toss_time) return false;
+    entry = it->second;
+    return true;
+}
+
+size_t Catalog::rebuild() {
+    flush();
+    auto guard = locks.catalogExclusive();
+
+    // the object store cannot be mapped back to paths: its entries still there come from the
+    // catalog, and from the copy of their records in the versions log when the catalog is lost
+    vector<CatalogEntry> stored;
+    set<string> kept;
+    string storePrefix = string("/") + META_DIR + "/";
+    auto keep = [&](vector<CatalogEntry> entries) {
+        struct stat info;
+        for (auto& entry: entries) {
+            if (!startsWith(entry.stored, storePrefix) || lstat((recycledir + entry.stored).c_str(), &info) != 0) continue;
+            if (kept.insert(keyOf(entry.stored, entry.original) + '\0' + to_string(entry.toss_time)).second) {
+                stored.push_back(move(entry));
+            }
+        }
+    };
+    if (exists()) keep(load());
+    keep(replay(readAll(versionsPath)));
+
+    // load all files in recycle bin, skipping our own bookkeeping
+    string metaDir = recycledir + "/" + META_DIR;
+    vector<vector<CatalogEntry>> perWorker(scanThreads());
+    scanTree(recycledir, [&](unsigned worker, const ScanEntry& entry) {
+        if (S_ISREG(entry.info.st_mode)) {
+            string stored = entry.path.substr(recycledir.size());
+            perWorker[worker].emplace_back(entry.info.st_ctime, entry.info.st_size, stored, stored);
+        }
+    }, [&](const string& dir) {
+        return dir == metaDir;
+    });
+
+    vector<CatalogEntry> entries = move(stored);
+    for (auto& part: perWorker) {
+        move(part.begin(), part.end(), back_inserter(entries));
+    }
+    stable_sort(entries.begin(), entries.end(), [](const auto &x, const auto &y) {return x.toss_time < y.toss_time;});
+
+    rewrite(entries);
+    return entries.size();
+}
+
+size_t Catalog::reconcile(const vector<string>& changed) {
+    flush();
+
+    // index keys of the live entries stored at, below or above one of the changed paths
+    auto affected = [&]() {
+        ensureIndex();
+        set<string> keys;
+        auto take = [&](const string& prefix) {
+            for (auto it = index.lower_bound(prefix); it != index.end() && startsWith(it->first, prefix); ++it) {
+                keys.insert(it->first);
+            }
+        };
+        for (const auto& path: changed) {
+            take(path + '\0');
+            take(path + '/');
+            string parent = path;
+            for (size_t slash; (slash = parent.rfind('/')) != string::npos && slash > 0; ) {
+                parent.erase(slash);
+                take(parent + '\0');
+            }
+        }
+        return keys;
+    };
+
+    // a first look tells which shards to lock, the second one is what counts
+    refresh(changed);
+    vector<string> shards = changed;
+    for (const auto& key: affected()) shards.push_back(index[key].stored);
+    sort(shards.begin(), shards.end());
+    shards.erase(unique(shards.begin(), shards.end()), shards.end());
+    locks.lockShards(shards);
+
+    size_t count = 0;
+    try {
+        refresh(changed);
+        struct stat info;
+        for (const auto& key: affected()) {
+            auto it = index.find(key);
+            if (it == index.end()) continue;
+            CatalogEntry entry = it->second;
+            if (lstat((recycledir + entry.stored).c_str(), &info) != 0) {
+                if (errno != ENOENT && errno != ENOTDIR) continue;
+                recordPurge(entry);
+                ++count;
+            } else if (entry.type == 'f' && S_ISREG(info.st_mode) && (uintmax_t)info.st_size != entry.size) {
+                CatalogEntry resized = entry;
+                resized.size = info.st_size;
+                account(entry, (long long)resized.size - (long long)entry.size, 0);
+                append('=', resized);
+                ++count;
+            }
+        }
+
+        // new files in the mirrored part, unless a directory entry above already holds them
+        auto covered = [&](const string& stored) {
+            if (references(stored) > 0) return true;
+            string parent = stored;
+            for (size_t slash; (slash = parent.rfind('/')) != string::npos && slash > 0; ) {
+                parent.erase(slash);
+                auto it = index.lower_bound(parent + '\0');
+                if (it != index.end() && startsWith(it->first, parent + '\0') && it->second.type == 'd') return true;
+            }
+            return false;
+        };
+        string metaDir = recycledir + "/" + META_DIR;
+        string storePrefix = string("/") + META_DIR;
+        for (const auto& path: changed) {
+            if (path.empty() || path == storePrefix || startsWith(path, storePrefix + "/")) continue;
+            if (lstat((recycledir + path).c_str(), &info) != 0) continue;
+
+            vector<CatalogEntry> found;
+            if (S_ISREG(info.st_mode)) {
+                found.emplace_back(info.st_ctime, info.st_size, path, path);
+            } else if (S_ISDIR(info.st_mode)) {
+                vector<vector<CatalogEntry>> perWorker(scanThreads());
+                scanTree(recycledir + path, [&](unsigned worker, const ScanEntry& entry) {
+                    if (S_ISREG(entry.info.st_mode)) {
+                        string stored = entry.path.substr(recycledir.size());
+                        perWorker[worker].emplace_back(entry.info.st_ctime, entry.info.st_size, stored, stored);
+                    }
+                }, [&](const string& dir) {
+                    return dir == metaDir;
+                });
+                for (auto& part: perWorker) move(part.begin(), part.end(), back_inserter(found));
+                stable_sort(found.begin(), found.end(), [](const auto &x, const auto &y) {return x.toss_time < y.toss_time;});
+            }
+            for (const auto& entry: found) {
+                if (covered(entry.stored)) continue;
+                recordToss(entry, false, true);
+                ++count;
+            }
+        }
+        flush();
+    } catch (...) {
+        locks.unlockShards();
+        throw;
+    }
+    locks.unlockShards();
+    return count;
+}
+
+size_t Catalog::compact() {
+    flush();
+    auto guard = locks.catalogExclusive();
+    vector<CatalogEntry> entries = load();
+    rewrite(entries);
+    return entries.size();
+}
+
+void Catalog::rewrite(const vector<CatalogEntry>& entries) {
+    flush();
+
+    // write the new catalog beside the old one and swap it in
+    // entries come in the order they were first recorded, which is not toss order for those
+    // recorded late (see the record format)
+    long newest = LONG_MIN;
+    for (const auto& entry: entries) {
+        append(entry.toss_time < newest ? '=' : '+', entry);
+        newest = max(newest, entry.toss_time);
+    }
+    ensureMetaDir(recycledir);
+    string tmpPath = catalogPath + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        pending.clear();
+        pendingVersions.clear();
+        throw toss_exception("failed to create catalog " + tmpPath + ": " + strerror(errno));
+    }
+    string data;
+    data.swap(pending);
+    try {
+        writeAll(fd, data, tmpPath);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    if (rename(tmpPath.c_str(), catalogPath.c_str()) != 0) {
+        throw toss_exception("failed to replace catalog " + catalogPath + ": " + strerror(errno));
+    }
+    data.clear();
+    data.swap(pendingVersions);
+    replaceFile(versionsPath, data);
+
+    // the new log starts with live records, and may reuse an inode the saved head names
+    unlink(headPath.c_str());
+
+    // the rewritten catalog is exact, so is its total
+    uintmax_t bytes = 0;
+    for (const auto& entry: entries) bytes += entry.size;
+    usageDelta = 0;
+    auto guard = locks.usage();
+    writeUsage(bytes);
+    rollup.build(entries);
+}
+
+bool Catalog::du(const string& dir, DirTotals& totals, vector<pair<string, DirTotals>>& children) {
+    flush();
+    if (!rollup.exists()) {
+        vector<CatalogEntry> entries = load();
+        auto guard = locks.usage();
+        if (!rollup.exists()) rollup.build(entries);
+    }
+    if (!rollup.read(dir, totals)) return false;
+    children = rollup.children(dir);
+
+    // the oldest toss of a directory whose oldest items were recovered or purged: the catalog
+    // is in toss order, so it is the first live entry below the directory
+    bool unknown = totals.atOldest == 0;
+    for (const auto& child: children) unknown = unknown || child.second.atOldest == 0;
+    if (!unknown) return true;
+
+    vector<CatalogEntry> entries = load();
+    auto guard = locks.usage();
+    auto settle = [&](const string& path, DirTotals& found) {
+        if (found.atOldest != 0) return;
+        string prefix = path == "/" ? path : path + "/";
+        for (const auto& entry: entries) {
+            if (!startsWith(entry.original, prefix) && !(entry.type == 'd' && entry.original == path)) continue;
+            if (found.atOldest == 0 || entry.toss_time < found.oldest) {
+                found.oldest = entry.toss_time;
+                found.atOldest = 0;
+            }
+            if (entry.toss_time == found.oldest) ++found.atOldest;
+        }
+        if (found.atOldest != 0) rollup.setOldest(path, found.oldest, found.atOldest);
+    };
+    settle(dir, totals);
+    for (auto& child: children) settle(child.first, child.second);
+    return true;
+}
+
+/** Tail **/
+
+CatalogTail::CatalogTail(const string& catalogPath) {
+    int fd = open(catalogPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) return;
+        throw toss_exception("failed to open catalog " + catalogPath + ": " + strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            throw toss_exception("failed to map catalog " + catalogPath + ": " + strerror(errno));
+        }
+        begin = static_cast<const char*>(mapped);
+        length = st.st_size;
+    }
+    close(fd);
+
+    // a torn final record from an interrupted write is not read
+    cursor = begin + length;
+    while (cursor > begin && cursor[-1] != '\n') --cursor;
+}
+
+CatalogTail::CatalogTail(CatalogTail&& other):begin(other.begin), length(other.length), cursor(other.cursor), bound(other.bound), seen(move(other.seen)), prefixes(move(other.prefixes)), byStored(other.byStored) {
+    other.begin = nullptr;
+    other.length = 0;
+}
+
+CatalogTail::~CatalogTail() {
+    if (begin != nullptr) munmap(const_cast<char*>(begin), length);
+}
+
+bool CatalogTail::next(CatalogEntry& entry) {
+    while (cursor > begin) {
+        const char* eol = cursor - 1;
+        const char* p = eol;
+        while (p > begin && p[-1] != '\n') --p;
+        cursor = p;
+
+        const char* fields[7];
+        if (!splitRecord(p, eol, fields)) continue;
+        if (*p == '+') bound = strtol(fields[2], nullptr, 10);
+        if (!prefixes.empty()) {
+            string_view path = byStored ? string_view(fields[5], eol - fields[5]) : string_view(fields[4], fields[5] - 1 - fields[4]);
+            if (!wanted(path)) continue;
+        }
+
+        // the escaped original and stored paths identify the item as well as the unescaped ones
+        if (!seen.insert(string_view(fields[4], eol - fields[4])).second) continue;
+        if (*p == '-') continue;
+        readEntry(fields, eol, entry);
+        return true;
+    }
+    return false;
+}
+
+void CatalogTail::restrict(const vector<string>& wanted, bool stored) {
+    byStored = stored;
+    // escaping keeps "/" and never merges characters, so escaped paths compare like the paths
+    vector<string> escaped;
+    for (const auto& prefix: wanted) {
+        escaped.emplace_back();
+        escapeField(escaped.back(), prefix);
+    }
+
+    // sorted, without the ones another prefix already covers: the only prefix a path can
+    // start with is then the last one not after it
+    sort(escaped.begin(), escaped.end());
+    prefixes.clear();
+    for (auto& prefix: escaped) {
+        if (prefixes.empty() || !startsWith(prefix, prefixes.back())) prefixes.push_back(move(prefix));
+    }
+}
+
+bool CatalogTail::wanted(string_view path) const {
+    auto after = upper_bound(prefixes.begin(), prefixes.end(), path, [](string_view x, const string& y) {return x < y;});
+    if (after != prefixes.begin() && path.compare(0, after[-1].size(), after[-1]) == 0) return true;
+
+    // a directory above a prefix: the prefixes below it start where path + "/" would sort
+    size_t n = path.size();
+    auto below = partition_point(after, prefixes.end(), [&](const string& prefix) {
+        int order = string_view(prefix).substr(0, n).compare(path);
+        return order != 0 ? order < 0 : prefix.size() == n || prefix[n] < '/';
+    });
+    return below != prefixes.end() && below->size() > n && (*below)[n] == '/' && below->compare(0, n, path) == 0;
+}
+
+/** Head **/
+
+CatalogHead::CatalogHead(const string& catalogPath, dev_t expectedDevice, ino_t expectedInode, size_t start) {
+    int fd = open(catalogPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) return;
+        throw toss_exception("failed to open catalog " + catalogPath + ": " + strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            throw toss_exception("failed to map catalog " + catalogPath + ": " + strerror(errno));
+        }
+        begin = static_cast<const char*>(mapped);
+        length = st.st_size;
+        device = st.st_dev;
+        inode = st.st_ino;
+    }
+    close(fd);
+
+    // a torn final record from an interrupted write is not read
+    end = begin + length;
+    while (end > begin && end[-1] != '\n') --end;
+
+    // the saved start only holds for the log it was taken from, and falls between records
+    cursor = begin;
+    if (device == expectedDevice && inode == expectedInode && start <= (size_t)(end - begin) && (start == 0 || begin[start - 1] == '\n')) {
+        cursor = begin + start;
+    }
+}
+
+CatalogHead::CatalogHead(CatalogHead&& other):begin(other.begin), length(other.length), cursor(other.cursor), end(other.end), device(other.device), inode(other.inode) {
+    other.begin = nullptr;
+    other.length = 0;
+}
+
+CatalogHead::~CatalogHead() {
+    if (begin != nullptr) munmap(const_cast<char*>(begin), length);
+}
+
+bool CatalogHead::next(CatalogEntry& entry) {
+    while (cursor < end) {
+        const char* p = cursor;
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        cursor = eol + 1;
+
+        const char* fields[7];
+        if (!splitRecord(p, eol, fields) || *p == '-') continue;
+        readEntry(fields, eol, entry);
+        return true;
+    }
+    return false;
+}
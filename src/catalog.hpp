@@ -0,0 +1,243 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_set>
+#include <string_view>
+#include <cstdint>
+#include <climits>
+#include <sys/types.h>
+#include <time.h>
+
+#include "lock.hpp"
+#include "rollup.hpp"
+
+/**
+ * One live item in the recycle bin.
+ * original = absolute path the item was tossed from
+ * stored = path of the item relative to the recycle bin, see objects.hpp for the layout
+ * type = 'f' for a file, 'd' for a directory tossed whole (size is the total of its files)
+ */
+struct CatalogEntry {
+    long toss_time;
+    uintmax_t size;
+    std::string original;
+    std::string stored;
+    char type;
+
+    // the tossed file's own mode, owner and times, for one stored in an object: the object's
+    // inode only keeps those of the first toss of its content (mode 0 when not recorded)
+    mode_t mode = 0;
+    uid_t uid = 0;
+    gid_t gid = 0;
+    struct timespec atime = {}, mtime = {};
+
+    CatalogEntry():toss_time(0), size(0), type('f'){}
+    CatalogEntry(long t, uintmax_t s, std::string o, std::string p, char type = 'f'):toss_time(t), size(s), original(o), stored(p), type(type){}
+};
+
+/**
+ * Live entries of a catalog, newest record first, read backwards from the end of the log
+ * - the newest record of an item decides it, a "-" one means it was recovered or purged
+ * - the newest items of a bin come after reading only the tail of its log, so a recent first
+ *   listing cut short by --limit costs the same on any size of bin
+ * - entries come in record order, which is toss order except for "=" records (see Catalog):
+ *   bound() says how recent the entries still to come can be
+ * The log is mapped read-only: appends made meanwhile are not seen, and a compaction swapping
+ * in a new log leaves the mapped one intact.
+ */
+class CatalogTail {
+private:
+    const char* begin = nullptr;
+    size_t length = 0;
+    const char* cursor = nullptr;   // end of the records not read yet
+    long bound = LONG_MAX;          // toss time of the last "+" record passed
+
+    // items already decided, as the escaped "original\tstored" of their records
+    std::unordered_set<std::string_view> seen;
+
+    std::vector<std::string> prefixes;     // escaped, see restrict()
+    bool byStored = false;
+
+    bool wanted(std::string_view path) const;
+
+public:
+    CatalogTail(const std::string& catalogPath);
+    CatalogTail(CatalogTail&& other);
+    CatalogTail(const CatalogTail&) = delete;
+    ~CatalogTail();
+
+    // the next live entry, false once the log is exhausted
+    bool next(CatalogEntry& entry);
+
+    // no entry next() has yet to return was tossed after this: the records before a "+" one
+    // are tossed at or before it (LONG_MAX until one was read)
+    long tossedBy() const { return bound; }
+
+    // only entries whose original path starts with one of the prefixes, or is a directory above
+    // one of them (it may hold their versions); other records are passed over unparsed
+    // stored: the same for the stored path instead
+    void restrict(const std::vector<std::string>& prefixes, bool stored = false);
+};
+
+/**
+ * Records of a catalog oldest first, read forward from the first one that may still be live
+ * (see Catalog::settleHead), so purge and eviction take the oldest items without reading the
+ * rest of the log
+ * - only live ("+" and "=") records are returned, unchecked against the records after them: the entry may
+ *   have been recovered, purged or updated since (Catalog::current() tells)
+ * The log is mapped read-only, as for CatalogTail.
+ */
+class CatalogHead {
+private:
+    const char* begin = nullptr;
+    size_t length = 0;
+    const char* cursor = nullptr;   // start of the records not read yet
+    const char* end = nullptr;      // end of the last whole record
+    dev_t device = 0;
+    ino_t inode = 0;
+
+public:
+    // start: offset of the first record to read, if the log is still the file device/inode
+    CatalogHead(const std::string& catalogPath, dev_t device, ino_t inode, size_t start);
+    CatalogHead(CatalogHead&& other);
+    CatalogHead(const CatalogHead&) = delete;
+    ~CatalogHead();
+
+    // the next "+" record, false once the log is exhausted
+    bool next(CatalogEntry& entry);
+
+    // read again from an offset() taken earlier, the records after it were not taken
+    void rewind(size_t offset) { cursor = begin + offset; }
+
+    // offset of the records not read yet, in the log of the given identity, and its length
+    size_t offset() const { return cursor - begin; }
+    size_t size() const { return end - begin; }
+    dev_t logDevice() const { return device; }
+    ino_t logInode() const { return inode; }
+};
+
+/**
+ * Append-only catalog of everything in a recycle bin, kept at <recycledir>/.toss/catalog
+ * - toss appends a "+" record, recover appends a "-" record
+ * - loading replays the log, so listing reads one file instead of walking the bin
+ * - rebuild() walks the bin and rewrites the log when the two have drifted apart
+ * - records are appended in toss order, so the log doubles as the expiry index for purge
+ * - the total size of the bin is kept in <recycledir>/.toss/usage and adjusted on every flush,
+ *   so quota checks never need to walk the bin or replay the log
+ * - so are the totals of every original directory, see rollup.hpp
+ *
+ * Record format, one per line, tab separated (tabs/newlines/backslashes in paths are escaped):
+ *   <+|-|=> <f|d> <toss time> <size> [<metadata>] <original> <stored>
+ * metadata is "<octal mode>:<uid>:<gid>:<atime>:<mtime>" (times as seconds.nanoseconds), kept
+ * for files stored in objects, see CatalogEntry.
+ * "=" is a live record like "+", written after records of later tosses: an update of an
+ * entry (its size after a partial recover or a change by hand), or a toss settled late (by the
+ * journal, or found in the bin by reconcile). Only "+" records are in toss order.
+ *
+ * Every toss of a path is its own entry, so the catalog is also the version history. One
+ * stored object can back several entries (the same content tossed from several paths).
+ * The records of entries in the object store are also appended to <recycledir>/.toss/versions
+ * (rewritten with the catalog), which is what rebuild() maps objects and trees back from.
+ * A directory entry merged into the bin absorbs the entries already stored below it, and
+ * recovering a directory drops every entry below it.
+ */
+class Catalog {
+private:
+    std::string recycledir;
+    std::string catalogPath;
+    std::string versionsPath;
+    std::string pending;
+    std::string pendingVersions;
+    std::string usagePath;
+    std::string headPath;
+    long long usageDelta = 0;
+
+    // live entries by stored path (then original), only loaded by the recover and merge paths
+    std::map<std::string, CatalogEntry> index;
+    bool indexed = false;
+    std::vector<std::string> scope;         // stored paths the index covers, every one if empty
+
+    BinLocks locks;
+    Rollup rollup;
+
+    void append(char op, const CatalogEntry& entry);
+    void account(const CatalogEntry& entry, long long bytes, long long items);
+    void ensureIndex();
+    void rewrite(const std::vector<CatalogEntry>& entries);
+    void writeUsage(uintmax_t bytes);
+
+public:
+    Catalog(const std::string& recycledir);
+    ~Catalog();
+
+    bool exists() const;
+
+    // buffer records, written out together on flush()
+    // replaces: the entry may take over a live one with the same stored and original path
+    // (identical content tossed again from the same place), whose size must not count twice
+    // late: the entry was tossed before records already in the log, see the record format
+    void recordToss(const CatalogEntry& entry, bool replaces = false, bool late = false);
+    void recordRecover(const CatalogEntry& entry);
+    void recordPurge(const CatalogEntry& entry);
+    // durable: fdatasync the catalog before returning, for the journal's commit point
+    void flush(bool durable = false);
+
+    // drop entries stored below a directory that was merged into the bin
+    // covered: their sizes are already part of the directory's
+    void dropNested(const std::string& stored, bool covered = false);
+
+    // shard locks of this bin's stored items, see lock.hpp
+    void lockShards(const std::vector<std::string>& stored) { locks.lockShards(stored); }
+    void unlockShards() { locks.unlockShards(); }
+
+    // forget the live entries read so far, the next lookup reads the log again to see what
+    // other tosses appended (call after taking the shard locks a decision depends on)
+    // stored: only read the entries stored at, below or above these paths, every lookup until
+    // the next refresh must be about one of them; on a big bin this is what keeps a small
+    // recover from indexing all of it
+    void refresh(const std::vector<std::string>& stored = {});
+
+    // true if this very toss (same stored item, original path and toss time) is live
+    bool contains(const CatalogEntry& entry);
+
+    // number of live entries backed by the object at stored
+    size_t references(const std::string& stored);
+
+    // replay the log into the list of live entries, oldest toss first, rebuilding first if there is no catalog yet
+    std::vector<CatalogEntry> load();
+
+    // live entries newest first, without replaying the whole log
+    CatalogTail tail();
+
+    // records oldest first, from where the last settleHead() left off
+    CatalogHead head();
+
+    // every record records has read so far is recovered or purged now, later head()s start
+    // after them; kept in <recycledir>/.toss/head until the log is rewritten
+    void settleHead(const CatalogHead& records);
+
+    // the live version of this toss (same stored and original path and toss time) into entry,
+    // false if it was recovered or purged
+    bool current(CatalogEntry& entry);
+
+    // walk the recycle bin and rewrite the catalog from what is on disk (the object store from the
+    // versions log), returns number of entries
+    size_t rebuild();
+
+    // bring the entries stored at, below or above these paths back in line with the bin after
+    // it was changed behind toss's back (see watch.hpp): items gone from disk are dropped,
+    // files whose size changed are updated, and regular files that appeared in the mirrored
+    // part of the bin are added as rebuild() would; returns the number of entries changed
+    size_t reconcile(const std::vector<std::string>& changed);
+
+    // rewrite the catalog with only the live entries, dropping recovered and purged records
+    size_t compact();
+
+    // total bytes in the bin, computed from the catalog once if the usage file is missing
+    uintmax_t usage();
+
+    // totals of the original directory dir and of its subdirectories, false if nothing in the
+    // bin was tossed from below dir; built from the catalog once if the bin has none yet
+    bool du(const std::string& dir, DirTotals& totals, std::vector<std::pair<std::string, DirTotals>>& children);
+};
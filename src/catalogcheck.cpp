@@ -0,0 +1,122 @@
+/**
+ * toss-catalogcheck: checks that a lost catalog is rebuilt whole, for `make test`
+ *
+ * Objects and trees in the store are named by content and by toss, not by the paths they came
+ * from, so rebuilding maps them back from the versions log. A scratch bin gets shared and
+ * unshared objects, a tree, and entries recovered or purged since; its catalog is deleted and
+ * rebuilt, and the live entries compared with the ones before. Exits 1 after printing every
+ * difference.
+ */
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <tuple>
+#include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "catalog.hpp"
+#include "toss.hpp"
+using namespace std;
+
+static string describe(const CatalogEntry& entry) {
+    return entry.original + " -> " + entry.stored + " at " + to_string(entry.toss_time);
+}
+
+static void sortEntries(vector<CatalogEntry>& entries) {
+    sort(entries.begin(), entries.end(), [](const auto& x, const auto& y) {
+        return tie(x.original, x.stored, x.toss_time) < tie(y.original, y.stored, y.toss_time);
+    });
+}
+
+static bool sameEntry(const CatalogEntry& x, const CatalogEntry& y) {
+    return x.original == y.original && x.stored == y.stored && x.toss_time == y.toss_time && x.size == y.size
+        && x.type == y.type && x.mode == y.mode && x.uid == y.uid && x.gid == y.gid
+        && x.mtime.tv_sec == y.mtime.tv_sec && x.mtime.tv_nsec == y.mtime.tv_nsec;
+}
+
+static void makeFile(const string& path, const string& content) {
+    filesystem::create_directories(filesystem::path(path).parent_path());
+    ofstream(path) << content;
+}
+
+int main() {
+    char scratch[] = "/tmp/toss-catalogcheck.XXXXXX";
+    if (mkdtemp(scratch) == nullptr) {
+        cerr << "toss-catalogcheck: cannot create a scratch directory" << endl;
+        return 1;
+    }
+    string bin = scratch;
+    string objects = string("/") + META_DIR + "/objects/";
+    string trees = string("/") + META_DIR + "/trees/";
+
+    int failures = 0;
+    try {
+        makeFile(bin + objects + "aa/shared", "same");
+        makeFile(bin + objects + "bb/single", "other");
+        makeFile(bin + objects + "cc/purged", "gone");
+        makeFile(bin + trees + "100.1-1-0/file", "tree");
+
+        CatalogEntry first(100, 4, "/home/u/a", objects + "aa/shared");
+        first.mode = 0100600;
+        first.uid = 1000;
+        first.gid = 1000;
+        first.mtime = {90, 5};
+        CatalogEntry second(110, 4, "/home/u/b", objects + "aa/shared");
+        second.mode = 0100755;
+        second.mtime = {95, 0};
+        CatalogEntry recovered(120, 4, "/home/u/c", objects + "aa/shared");
+        CatalogEntry single(130, 5, "/home/u/d", objects + "bb/single");
+        CatalogEntry purged(140, 4, "/home/u/e", objects + "cc/purged");
+        CatalogEntry tree(150, 4, "/home/u/dir", trees + "100.1-1-0", 'd');
+
+        vector<CatalogEntry> before;
+        {
+            Catalog catalog(bin);
+            for (const auto& entry: {first, second, recovered, single, purged, tree}) catalog.recordToss(entry);
+            catalog.recordRecover(recovered);
+            catalog.recordPurge(purged);
+            catalog.flush();
+            filesystem::remove(bin + objects + "cc/purged");
+            before = catalog.load();
+        }
+
+        filesystem::remove(metaPath(bin, "catalog"));
+        vector<CatalogEntry> after;
+        {
+            Catalog catalog(bin);
+            catalog.rebuild();
+            after = catalog.load();
+        }
+
+        sortEntries(before);
+        sortEntries(after);
+        for (const auto& entry: before) {
+            auto found = find_if(after.begin(), after.end(), [&](const auto& other) {return sameEntry(entry, other);});
+            if (found == after.end()) {
+                cerr << "lost by the rebuild: " << describe(entry) << endl;
+                ++failures;
+            }
+        }
+        for (const auto& entry: after) {
+            auto found = find_if(before.begin(), before.end(), [&](const auto& other) {return sameEntry(entry, other);});
+            if (found == before.end()) {
+                cerr << "brought back by the rebuild: " << describe(entry) << endl;
+                ++failures;
+            }
+        }
+        if (before.size() != 4) {
+            cerr << before.size() << " live entries before the rebuild, expected 4" << endl;
+            ++failures;
+        }
+        if (failures == 0) cout << "catalog: " << after.size() << " entries rebuilt from the versions log" << endl;
+    } catch (const toss_exception& e) {
+        cerr << "toss-catalogcheck: " << e.what() << endl;
+        ++failures;
+    }
+
+    filesystem::remove_all(bin);
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+#include "config.hpp"
+#include "toss.hpp"
+
+#include <fstream>
+#include <cctype>
+#include <cstdio>
+using namespace std;
+
+uintmax_t parseSize(const string& text) {
+    size_t used = 0;
+    double value = 0;
+    try {
+        value = stod(text, &used);
+    } catch (const logic_error&) {
+        throw toss_exception("invalid size: \"" + text + "\"");
+    }
+    if (value < 0) throw toss_exception("invalid size: \"" + text + "\"");
+
+    string unit = text.substr(used);
+    if (!unit.empty() && (unit.back() == 'B' || unit.back() == 'b') && unit.size() > 1) unit.pop_back();
+    if (unit.size() > 1) throw toss_exception("invalid size: \"" + text + "\"");
+
+    const string units = "BKMGTPE";
+    size_t power = 0;
+    if (!unit.empty()) {
+        power = units.find(toupper(unit[0]));
+        if (power == string::npos) throw toss_exception("invalid size: \"" + text + "\"");
+    }
+    for (size_t i = 0; i < power; ++i) value *= 1024;
+    return static_cast<uintmax_t>(value);
+}
+
+Config loadConfig(const string& recycledir) {
+    Config config;
+    ifstream file(metaPath(recycledir, "config"));
+    string line;
+    while (getline(file, line)) {
+        size_t eq = line.find('=');
+        if (eq == string::npos) continue;
+        string key = line.substr(0, eq);
+        string value = line.substr(eq + 1);
+        if (key == "quota") config.quota = strtoull(value.c_str(), nullptr, 10);
+    }
+    return config;
+}
+
+void saveConfig(const string& recycledir, const Config& config) {
+    ensureMetaDir(recycledir);
+    string path = metaPath(recycledir, "config");
+    ofstream file(path + ".tmp", ios::trunc);
+    file << "quota=" << config.quota << "\n";
+    file.close();
+    if (!file || rename((path + ".tmp").c_str(), path.c_str()) != 0) {
+        throw toss_exception("failed to write " + path);
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+/**
+ * User settings, kept as key=value lines in ~/.recyclebin/.toss/config
+ * quota = most bytes a single recycle bin may hold, 0 for no limit
+ */
+struct Config {
+    uintmax_t quota = 0;
+};
+
+Config loadConfig(const std::string& recycledir);
+void saveConfig(const std::string& recycledir, const Config& config);
+
+// parse sizes such as "512", "200M" or "10G" (powers of 1024), throws toss_exception if malformed
+uintmax_t parseSize(const std::string& text);
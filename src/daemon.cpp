@@ -0,0 +1,223 @@
+#include "daemon.hpp"
+#include "toss.hpp"
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+using namespace std;
+
+string homeRecycleBin() {
+    const char* home = getenv("HOME");
+    string homedir = home != nullptr && *home != '\0' ? home : getpwuid(getuid())->pw_dir;
+    return homedir + "/.recyclebin";
+}
+
+bool invokedAs(const char* argv0, const char* name) {
+    const char* slash = strrchr(argv0, '/');
+    return strcmp(slash == nullptr ? argv0 : slash + 1, name) == 0;
+}
+
+static bool writeAll(int fd, const void* data, size_t length) {
+    const char* p = static_cast<const char*>(data);
+    while (length > 0) {
+        ssize_t n = send(fd, p, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void* data, size_t length) {
+    char* p = static_cast<char*>(data);
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+/** Requests **/
+
+// on_exit() hook of a request: the exit status goes back to the client once the output is out
+static void reportStatus(int code, void* arg) {
+    int sock = static_cast<int>(reinterpret_cast<intptr_t>(arg));
+    cout.flush();
+    cerr.flush();
+    fflush(nullptr);
+    int32_t status = code & 0xff;
+    writeAll(sock, &status, sizeof(status));
+}
+
+// runs the request on sock, never returns
+[[noreturn]] static void serveRequest(int sock, Command run) {
+    uint32_t length = 0;
+    int fds[3];
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+    iovec iov = {&length, sizeof(length)};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(length)) _exit(1);
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)) || length > TOSSD_MAX_REQUEST) _exit(1);
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    // kept for the whole run: argv and the environment point into it
+    char* request = new char[length + 1];
+    if (!readAll(sock, request, length)) _exit(1);
+    request[length] = '\0';
+    vector<char*> fields;
+    for (char* p = request; p < request + length; p += strlen(p) + 1) fields.push_back(p);
+    if (fields.size() < 3) _exit(1);
+    size_t argc = strtoul(fields[2], nullptr, 10);
+    if (argc == 0 || fields.size() < 3 + argc) _exit(1);
+
+    int32_t pid = getpid();
+    if (!writeAll(sock, &pid, sizeof(pid))) _exit(1);
+
+    // the client's terminal, files and pipes, outside the daemon's session
+    setsid();
+    for (int fd = 0; fd < 3; ++fd) {
+        dup2(fds[fd], fd);
+        close(fds[fd]);
+    }
+    umask(strtoul(fields[1], nullptr, 10));
+    clearenv();
+    for (size_t i = 3 + argc; i < fields.size(); ++i) putenv(fields[i]);
+    vector<char*> argv(fields.begin() + 3, fields.begin() + 3 + argc);
+    argv.push_back(nullptr);
+
+    on_exit(reportStatus, reinterpret_cast<void*>(static_cast<intptr_t>(sock)));
+    if (chdir(fields[0]) != 0) {
+        cerr << "toss error: cannot change to " << fields[0] << ": " << strerror(errno) << endl;
+        exit(1);
+    }
+    exit(run(argc, argv.data()));
+}
+
+// a child waiting for the next request: it tells the parent once it has one, and runs it
+[[noreturn]] static void takeRequest(int listener, int taken, Command run) {
+    for (;;) {
+        int sock = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            _exit(0);   // the listener was shut down
+        }
+
+        ucred peer;
+        socklen_t size = sizeof(peer);
+        if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &peer, &size) != 0 || peer.uid != geteuid()) {
+            close(sock);
+            continue;
+        }
+
+        char byte = 1;
+        ssize_t n = write(taken, &byte, 1);
+        (void)n;
+        close(taken);
+        close(listener);
+        serveRequest(sock, run);
+    }
+}
+
+/** Server **/
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stopServing(int) {
+    stopping = 1;
+}
+
+static int listenOn(const string& path) {
+    sockaddr_un addr = {};
+    if (path.size() >= sizeof(addr.sun_path)) throw toss_exception("socket path too long: " + path);
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) throw toss_exception(string("cannot create socket: ") + strerror(errno));
+
+    // a socket nobody answers on is left over from a daemon that did not stop cleanly
+    if (connect(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+        throw toss_exception("tossd is already running on " + path);
+    }
+    close(listener);
+    unlink(path.c_str());
+
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t mask = umask(S_IRWXG | S_IRWXO);
+    int bound = bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    umask(mask);
+    if (bound != 0 || listen(listener, SOMAXCONN) != 0) {
+        throw toss_exception("cannot listen on " + path + ": " + strerror(errno));
+    }
+    return listener;
+}
+
+int serveDaemon(Command run) {
+    string recycledir = homeRecycleBin();
+    if (mkdir(recycledir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) != 0 && errno != EEXIST) {
+        throw toss_exception("cannot create " + recycledir + ": " + strerror(errno));
+    }
+    ensureMetaDir(recycledir);
+
+    // descriptors handed over by clients must never land on 0, 1 or 2
+    for (int fd = 0; fd < 3; ++fd) {
+        if (fcntl(fd, F_GETFD) < 0) open("/dev/null", O_RDWR);
+    }
+
+    string path = metaPath(recycledir, TOSSD_SOCKET);
+    int listener = listenOn(path);
+
+    // no SA_RESTART, so a stop request interrupts the wait below
+    struct sigaction stop = {};
+    stop.sa_handler = stopServing;
+    sigaction(SIGINT, &stop, nullptr);
+    sigaction(SIGTERM, &stop, nullptr);
+    signal(SIGCHLD, SIG_IGN);       // requests are reaped by the kernel
+    signal(SIGPIPE, SIG_IGN);
+
+    while (!stopping) {
+        int taken[2];
+        if (pipe2(taken, O_CLOEXEC) != 0) throw toss_exception(string("cannot create pipe: ") + strerror(errno));
+        pid_t child = fork();
+        if (child == 0) {
+            close(taken[0]);
+            for (int sig: {SIGINT, SIGTERM, SIGCHLD, SIGPIPE}) signal(sig, SIG_DFL);
+            takeRequest(listener, taken[1], run);
+        }
+        close(taken[1]);
+        if (child < 0) {
+            close(taken[0]);
+            sleep(1);
+            continue;
+        }
+
+        // the next child is forked once this one has a request (or died waiting)
+        char byte;
+        while (!stopping && read(taken[0], &byte, 1) < 0 && errno == EINTR) {}
+        close(taken[0]);
+    }
+
+    // wakes the waiting child out of accept(), requests already taken run to the end
+    unlink(path.c_str());
+    shutdown(listener, SHUT_RDWR);
+    close(listener);
+    return 0;
+}
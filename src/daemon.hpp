@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+
+/**
+ * tossd, an optional server running toss commands without starting a toss process for each
+ * - bin/tossd is bin/toss under another name; it listens on ~/.recyclebin/.toss/tossd.sock
+ *   and only serves its own user (SO_PEERCRED)
+ * - bin/tossc is the client: a small static program that sends its working directory, umask,
+ *   arguments and environment, hands over its stdin, stdout and stderr (SCM_RIGHTS) and exits
+ *   with the status of the command; with no daemon listening it runs bin/toss instead
+ * - a child forked ahead of time is already waiting in accept(), with the program loaded, the
+ *   bin set up and the catalogs in the page cache, and runs the command on the client's
+ *   descriptors exactly as bin/toss would; the next child is forked while it runs, so a
+ *   request costs neither an exec of the full program, its dynamic linking, nor a fork
+ *
+ * Protocol, on one stream connection:
+ *   client: uint32 length, with the three descriptors attached
+ *   client: length bytes of '\0' terminated strings: cwd, umask, argc, argv..., environment...
+ *   server: int32 pid of the process running the command (signals are passed on to it)
+ *   server: int32 exit status, once the command is done and its output flushed
+ */
+constexpr const char* TOSSD_SOCKET = "tossd.sock";
+
+// a request bigger than this is not a command line
+constexpr unsigned TOSSD_MAX_REQUEST = 64 << 20;
+
+using Command = int (*)(int argc, char* argv[]);
+
+// the recycle bin of the user in HOME, or in the password database without one
+std::string homeRecycleBin();
+
+// true if argv[0] names this program, e.g. "tossd" for bin/tossd linked to bin/toss
+bool invokedAs(const char* argv0, const char* name);
+
+// serve until SIGINT or SIGTERM
+int serveDaemon(Command run);
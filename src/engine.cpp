@@ -0,0 +1,608 @@
+#include "engine.hpp"
+
+#include <filesystem>
+#include <algorithm>
+#include <queue>
+#include <map>
+#include <set>
+#include <ctime>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "toss.hpp"
+#include "transfer.hpp"
+#include "scanner.hpp"
+#include "config.hpp"
+#include "listing.hpp"
+#include "stats.hpp"
+using namespace std;
+
+static bool isRelativePath(const string& str) {
+    return str.rfind("/", 0) != 0 && str.rfind("~", 0) != 0 && str.rfind("\\", 0) != 0;
+}
+
+// relative to cwd, with "." and ".." (as in find's "./dir/file") resolved without touching the disk
+string absolutePath(const string& cwd, const string& input) {
+    string path = filesystem::path(isRelativePath(input) ? cwd + "/" + input : input).lexically_normal().string();
+    while (path.size() > 1 && path.back() == '/') path.pop_back();
+    return path;
+}
+
+Engine::Engine(const string& recycledir): recycledir(recycledir) {
+    // EEXIST is the error that throws if already exists, otherwise some other error
+    if (mkdir(recycledir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) != 0 && errno != EEXIST) {
+        throw toss_exception("cannot create recycle bin " + recycledir + ": " + strerror(errno));
+    }
+    {
+        Phase phase("open recycle bins");
+        registry = make_unique<BinRegistry>(recycledir);
+    }
+
+    // settle whatever a toss killed in the middle of a batch left behind
+    Phase phase("replay journals");
+    replay = replayJournals(*registry);
+}
+
+Engine::~Engine() = default;
+
+/** Toss and Recover **/
+
+// a recover's source is the newest version (or the one asked for) in the recycle bin, its destination the original path
+void Engine::planRecover(const string& dest, const PlanOptions& options, vector<TossMove>& unsorted) {
+    if (!versions) loadHistory();
+    vector<Version> found = versions->versionsOf(dest);
+    if (options.revision != 0) {
+        if (options.revision < 1 || (size_t)options.revision > found.size()) {
+            throw toss_exception("no version " + to_string(options.revision) + " of " + dest + " (see toss --history " + dest + ")");
+        }
+        found.erase(found.begin() + options.revision, found.end());
+    }
+
+    // the directory was never tossed whole, recover the newest version of everything below it
+    if (found.empty() && options.recursive) {
+        vector<Version> below = versions->latestBelow(dest);
+        for (auto& version: below) {
+            unsorted.push_back({version.source, version.entry.original, version.bin, version.entry});
+        }
+        if (!below.empty()) return;
+    }
+
+    if (!found.empty()) {
+        unsorted.push_back({found.back().source, dest, found.back().bin, found.back().entry});
+    } else {
+        // not in any catalog, try where older bins kept it
+        string bin = registry->find(dest);
+        unsorted.push_back({bin + dest, dest, bin, CatalogEntry(options.time, 0, dest, dest)});
+    }
+}
+
+Plan Engine::plan(const vector<string>& paths, const PlanOptions& options) {
+    Phase phase("resolve paths");
+    Plan plan;
+    plan.recover = options.recover;
+    plan.time = options.time != 0 ? options.time : time(nullptr);
+    PlanOptions resolved = options;
+    resolved.time = plan.time;
+    const string cwd = options.cwd.empty() ? filesystem::current_path().string() : options.cwd;
+
+    /* prepare source and destination file pairs
+        - if recovering, src moves from recycle bin to actual file
+        - if tossing, src moves from actual file to recycle bin (its place there is picked at move time)
+    */
+    vector<TossMove> unsorted;
+    unsorted.reserve(paths.size());
+    for (string input: paths) {
+        // "dir/" and "dir" are the same item in the recycle bin
+        while (input.size() > 1 && input.back() == '/') input.pop_back();
+
+        // do not include recycledir path in file input
+        if (registry->isBinPath(input)) {
+            throw toss_exception("do not include recycle directory: \"" + recycledir + "\" in the filename");
+        }
+
+        string path = absolutePath(cwd, input);
+        if (options.recover) planRecover(path, resolved, unsorted);
+        else unsorted.push_back({path, "", registry->binFor(path), CatalogEntry()});
+    }
+
+    // every lstat the batch needs goes through the executor together: what each source is,
+    // and when recovering, what is in the way at its destination
+    if (!executor) executor = makeExecutor();
+    vector<FsOp> stats;
+    stats.reserve(unsorted.size() * 2);
+    for (const auto& item: unsorted) {
+        stats.push_back(FsOp::statPath(item.src));
+        if (options.recover) stats.push_back(FsOp::statPath(item.dest, STATX_INO | STATX_TYPE));
+    }
+    {
+        Phase stating("stat sources");
+        executor->run(stats);
+    }
+
+    /**
+     * Sort the items into files and directories
+     * 1. non-directory files, a recovered one must be in the recycle bin
+     * 2. throw error if a directory is given without recursive
+     * 3. directories whole, they are moved with a single rename (or merged into an existing one,
+     *    a recovered one cannot take the place of a file)
+     */
+    for (size_t i = 0; i < unsorted.size(); ++i) {
+        TossMove& item = unsorted[i];
+        const FsOp& stat = stats[options.recover ? 2 * i : i];
+        item.statResult = stat.result;
+        item.info = stat.info;
+        if (options.recover && stats[2 * i + 1].result == 0) item.replaced = stats[2 * i + 1].info.stx_ino;
+
+        if (item.statResult != 0 || !S_ISDIR(item.info.stx_mode)) {
+            if (options.recover) {
+                if (item.statResult != 0) {
+                    throw toss_exception("failed to recover - file not found in recycle bin: " + item.src);
+                }
+                item.entry.size = item.info.stx_size;
+            }
+            plan.files.push_back(move(item));
+        } else if (!options.recursive) {
+            throw toss_exception(item.src + " is a directory. Use --recursive flag to include directories");
+        } else if (item.replaced != 0 && !S_ISDIR(stats[2 * i + 1].info.stx_mode)) {
+            throw toss_exception("cannot replace " + item.dest + " with directory " + item.src);
+        } else {
+            TreeSize moved = treeSize(item.src);
+            item.files = moved.files;
+            if (options.recover) {
+                item.entry.size = moved.bytes;
+                item.entry.type = 'd';
+            } else {
+                item.entry = CatalogEntry(plan.time, moved.bytes, item.src, "", 'd');
+            }
+            plan.dirs.push_back(move(item));
+        }
+    }
+
+    // recovered files go out in destination order, so the renames into one directory come together
+    if (options.recover) {
+        stable_sort(plan.files.begin(), plan.files.end(), [](const TossMove& x, const TossMove& y) {return x.dest < y.dest;});
+    }
+
+    // the files being tossed start hashing now, while the caller gets on with the batch before
+    if (!options.recover && options.hash) hashFiles(plan);
+    return plan;
+}
+
+void Engine::hashFiles(Plan& plan) {
+    vector<string> sources;
+    sources.reserve(plan.files.size());
+    for (const auto& file: plan.files) sources.push_back(file.src);
+    plan.hashes = make_unique<HashAhead>(move(sources), scanThreads());
+}
+
+vector<string> Engine::conflicts(const Plan& plan) {
+    vector<string> found;
+    if (!plan.recover) return found;
+    for (const auto& dir: plan.dirs) {
+        if (dir.replaced != 0) mergeConflicts(dir.src, dir.dest, found);
+    }
+    for (const auto& file: plan.files) {
+        if (file.replaced != 0) found.push_back(file.dest);
+    }
+    return found;
+}
+
+PlanReport Engine::describe(Plan& plan) {
+    Phase phase("describe plan");
+    PlanReport report;
+    report.replaced = conflicts(plan);
+
+    vector<TossMove*> items;
+    for (auto& dir: plan.dirs) items.push_back(&dir);
+    for (auto& file: plan.files) items.push_back(&file);
+
+    // where each item lands: the bin it is tossed into, or the directory it is recovered into,
+    // every distinct one stat'ed in one batch
+    map<string, size_t> index;
+    vector<size_t> landing(items.size());
+    vector<FsOp> stats;
+    for (size_t i = 0; i < items.size(); ++i) {
+        string dir = plan.recover ? filesystem::path(items[i]->dest).parent_path().string() : items[i]->bin;
+        auto found = index.emplace(dir, stats.size());
+        if (found.second) stats.push_back(FsOp::statPath(dir));
+        landing[i] = found.first->second;
+    }
+    {
+        Phase stating("stat destinations");
+        executor->run(stats);
+    }
+
+    // a missing directory is created along with the ones above it, up to one that exists
+    set<string> created;
+    for (auto& stat: stats) {
+        filesystem::path dir = stat.path;
+        while (stat.result == -ENOENT && dir != dir.root_path()) {
+            created.insert(dir.string());
+            dir = dir.parent_path();
+            stat.result = statx(AT_FDCWD, dir.c_str(), AT_SYMLINK_NOFOLLOW, STATX_BASIC_STATS, &stat.info) == 0 ? 0 : -errno;
+        }
+    }
+    report.created.assign(created.begin(), created.end());
+
+    for (size_t i = 0; i < items.size(); ++i) {
+        TossMove& item = *items[i];
+        const FsOp& dest = stats[landing[i]];
+        if (item.statResult == 0 && dest.result == 0) {
+            item.copied = item.info.stx_dev_major != dest.info.stx_dev_major || item.info.stx_dev_minor != dest.info.stx_dev_minor;
+        }
+
+        // a toss of a file that is gone fails when executed, and moves nothing
+        uintmax_t bytes = item.entry.size;
+        if (item.entry.type == 'd') {
+            report.files += item.files;
+        } else if (item.statResult == 0) {
+            bytes = item.info.stx_size;
+            ++report.files;
+        } else {
+            continue;
+        }
+        report.bytes += bytes;
+        if (item.copied) report.copiedBytes += bytes;
+    }
+    return report;
+}
+
+// log the directories of the batch, and the recovered files with the objects they use locked
+void Engine::journalBatch(Plan& plan) {
+    for (auto& dir: plan.dirs) {
+        if (plan.recover) {
+            journal->intendRecover(dir.bin, dir.entry, dir.replaced, dir.info);
+        } else {
+            dir.entry.stored = storeOf(stores, dir.bin).newTreePath();
+            journal->intendToss(dir.bin, dir.entry, dir.info);
+        }
+    }
+    if (!plan.recover) return;
+
+    map<string, vector<string>> scope;
+    for (const auto& dir: plan.dirs) scope[dir.bin].push_back(dir.entry.stored);
+    for (const auto& file: plan.files) {
+        journal->intendRecover(file.bin, file.entry, file.replaced, file.info);
+        scope[file.bin].push_back(file.entry.stored);
+    }
+
+    // whether an object is shared is decided under its shard lock, against a fresh catalog; the
+    // trees and mirrored paths moved out are locked too, so the watcher waits for their records
+    for (const auto& bin: scope) {
+        Catalog& catalog = registry->catalogFor(bin.first);
+        catalog.lockShards(bin.second);
+        catalog.refresh(bin.second);
+    }
+}
+
+// an object keeps the inode of the first toss of its content, each entry its own file's metadata
+static void keepMetadata(CatalogEntry& entry, const struct statx& info) {
+    entry.mode = info.stx_mode;
+    entry.uid = info.stx_uid;
+    entry.gid = info.stx_gid;
+    entry.atime = {info.stx_atime.tv_sec, info.stx_atime.tv_nsec};
+    entry.mtime = {info.stx_mtime.tv_sec, info.stx_mtime.tv_nsec};
+}
+
+// give a file recovered from an object the metadata of the toss it came from, where the
+// object's (stored: as planned) differs, e.g. for the second toss of the same content
+static void restoreMetadata(const string& path, const CatalogEntry& entry, const struct statx& stored) {
+    if (entry.mode == 0) return;
+    bool same = (entry.mode & 07777) == (stored.stx_mode & 07777) && entry.uid == stored.stx_uid && entry.gid == stored.stx_gid
+        && entry.mtime.tv_sec == stored.stx_mtime.tv_sec && entry.mtime.tv_nsec == stored.stx_mtime.tv_nsec;
+    if (same) return;
+
+    // owner first, changing it clears the set-id bits; failures leave what copy or move gave
+    int failed = lchown(path.c_str(), entry.uid, entry.gid);
+    if (!S_ISLNK(entry.mode)) failed |= chmod(path.c_str(), entry.mode & 07777);
+    (void)failed;
+    struct timespec times[2] = {entry.atime, entry.mtime};
+    utimensat(AT_FDCWD, path.c_str(), times, AT_SYMLINK_NOFOLLOW);
+}
+
+// files being tossed are stored as one batch through the executor, hashed while it was planned
+void Engine::storeFiles(Plan& plan, uintmax_t& count) {
+    Phase phase("store files");
+    if (!plan.hashes) hashFiles(plan);
+    vector<TossItem> items;
+    items.reserve(plan.files.size());
+    for (const auto& file: plan.files) items.push_back({file.src, file.bin, file.statResult, file.info});
+
+    // the files' places in the bin are known once they are hashed: lock the objects against
+    // a concurrent purge or recover deciding they are unused, and log them with the directories;
+    // the directories' trees are locked in the same call (shards are taken in one go per bin)
+    auto logMoves = [&](const vector<StoredItem>& planned) {
+        map<string, vector<string>> stored;
+        for (const auto& dir: plan.dirs) stored[dir.bin].push_back(dir.entry.stored);
+        for (size_t i = 0; i < planned.size(); ++i) {
+            if (planned[i].error != 0) continue;
+            stored[items[i].bin].push_back(planned[i].stored);
+            journal->intendToss(items[i].bin, {plan.time, planned[i].size, items[i].src, planned[i].stored}, items[i].info);
+        }
+        for (const auto& bin: stored) {
+            Catalog& catalog = registry->catalogFor(bin.first);
+            catalog.lockShards(bin.second);
+            catalog.refresh(bin.second);
+        }
+        journal->sync();
+    };
+    vector<StoredItem> stored = storeBatch(items, *plan.hashes, *executor, stores, logMoves);
+
+    // record everything that was moved, then report the first failure
+    size_t failed = stored.size();
+    for (size_t i = 0; i < stored.size(); ++i) {
+        if (stored[i].error != 0) {
+            failed = min(failed, i);
+            continue;
+        }
+        CatalogEntry entry(plan.time, stored[i].size, items[i].src, stored[i].stored);
+        keepMetadata(entry, items[i].info);
+        registry->catalogFor(items[i].bin).recordToss(entry, stored[i].deduplicated);
+        ++count;
+    }
+    for (const auto& item: items) touched.insert(item.bin);
+    if (failed < stored.size()) {
+        if (stored[failed].error == ENOENT) throw toss_exception("failed to toss - file not found " + items[failed].src);
+        if (stored[failed].error == EEXIST) throw toss_exception("failed to toss - different content is stored under the same hash as " + items[failed].src);
+        throw filesystem::filesystem_error("cannot toss " + items[failed].src, error_code(stored[failed].error, generic_category()));
+    }
+}
+
+// directories move whole, into a fresh tree in the bin, or merged into the destination if it already exists
+void Engine::moveDirs(Plan& plan, const ConfirmReplace& confirm, uintmax_t& count) {
+    Phase phase("move directories");
+    for (const auto& dir: plan.dirs) {
+        Catalog& catalog = registry->catalogFor(dir.bin);
+        journal->sync();
+        if (plan.recover) {
+            moveTree(dir.src, dir.dest, false, confirm);
+            catalog.recordRecover(dir.entry);
+        } else {
+            moveTree(dir.src, dir.bin + dir.entry.stored, true, confirm);
+            catalog.recordToss(dir.entry);
+            touched.insert(dir.bin);
+        }
+        count += dir.files;
+    }
+}
+
+// files being recovered are moved one at a time, asking before each replace
+void Engine::recoverFiles(Plan& plan, const ConfirmReplace& confirm, uintmax_t& count) {
+    if (!plan.recover) return;
+    Phase phase("recover files");
+    for (const auto& file: plan.files) {
+        filesystem::path src = file.src;
+        filesystem::path dest = file.dest;
+        Catalog& catalog = registry->catalogFor(file.bin);
+        journal->sync();
+
+        // confirm recovery if file already exists at destination
+        if (file.replaced != 0 && confirm && !confirm(dest.string())) throw toss_canceled();
+
+        /**
+         * An object other versions still point at is copied out, otherwise it is moved
+         * - over the file in the way, once confirmed
+         * - or with a rename that fails rather than replace a file that turned up since the
+         *   batch was planned; the journal logged nothing in the way, so it must stay that way
+         */
+        if (isStoreEntry(file.entry.stored) && catalog.references(file.entry.stored) > 1) {
+            filesystem::create_directories(dest.parent_path());
+            copyFile(src, dest);
+        } else if (file.replaced != 0) {
+            movePath(src, dest);
+        } else if (!moveNoReplace(src, dest)) {
+            throw toss_exception("failed to recover - " + dest.string() + " was created while recovering, nothing was replaced");
+        }
+
+        restoreMetadata(dest.string(), file.entry, file.info);
+
+        // keep the catalog in step with the move
+        catalog.recordRecover(file.entry);
+        ++count;
+    }
+}
+
+// a batch stopped by an error: what was moved is kept and recorded, the journal has nothing left to settle
+void Engine::abandonBatch() {
+    try {
+        registry->flush(true);
+        journal->clear();
+        registry->unlockShards();
+    } catch (const toss_exception&) {}
+}
+
+uintmax_t Engine::execute(Plan& plan, const ConfirmReplace& confirm) {
+    // intents of each batch, so a toss killed midway is settled by the next one
+    if (!journal) journal = make_unique<Journal>(registry->home());
+
+    // every move of the batch is logged to the journal, and the log synced once, before any of them starts
+    uintmax_t count = 0;
+    try {
+        {
+            Phase phase("journal batch");
+            journalBatch(plan);
+        }
+        if (!plan.recover) storeFiles(plan, count);
+        moveDirs(plan, confirm, count);
+        recoverFiles(plan, confirm, count);
+    } catch (...) {
+        abandonBatch();
+        versions.reset();
+        throw;
+    }
+
+    // commit point: the batch's records are durable, so its intents and locks can go
+    Phase phase("commit batch");
+    registry->flush(true);
+    journal->clear();
+    registry->unlockShards();
+
+    // the next batch's revisions count only the versions still there
+    if (versions && plan.recover) {
+        for (const auto& dir: plan.dirs) versions->forget(dir.bin, dir.entry);
+        for (const auto& file: plan.files) versions->forget(file.bin, file.entry);
+    } else if (versions) {
+        versions.reset();
+    }
+    return count;
+}
+
+PurgeResult Engine::enforceQuota(long keepFrom) {
+    PurgeResult evicted;
+    uintmax_t limit = quota();
+    if (limit > 0) {
+        Phase phase("quota eviction");
+        for (const auto& bin: touched) {
+            PurgeResult result = evictBin(bin, registry->catalogFor(bin), limit, keepFrom);
+            evicted.bytes += result.bytes;
+            evicted.files += result.files;
+        }
+        registry->flush();
+    }
+    touched.clear();
+    return evicted;
+}
+
+/** History **/
+
+void Engine::loadHistory(const vector<string>& prefixes) {
+    Phase phase("load history");
+    versions = make_unique<History>(*registry, prefixes);
+}
+
+vector<Version> Engine::versionsOf(const string& path) {
+    if (!versions) loadHistory();
+    return versions->versionsOf(path);
+}
+
+vector<string> Engine::matching(const vector<Pattern>& patterns) {
+    if (!versions) loadHistory();
+    return versions->matching(patterns);
+}
+
+/** Listing **/
+
+void Engine::list(ListOrder order, size_t offset, size_t limit, const vector<Pattern>& patterns, const ListRow& row) {
+    Phase phase("list");
+    auto selected = [&](const CatalogEntry& entry) {
+        if (patterns.empty()) return true;
+        for (const auto& pattern: patterns) {
+            if (pattern.matches(entry.original)) return true;
+        }
+        return false;
+    };
+
+    // every bin's catalog read from its newest record back
+    vector<CatalogTail> tails;
+    for (const auto& bin: registry->all()) tails.push_back(registry->catalogFor(bin).tail());
+
+    // by recent: the catalogs are mostly in toss order, so merging their tails yields the
+    // listing and stops as soon as enough items are out; an entry recorded out of order waits
+    // until no tail can still hold a newer one
+    size_t end = limit > SIZE_MAX - offset ? SIZE_MAX : offset + limit;
+    if (order == Recent) {
+        auto older = [](const CatalogEntry& x, const CatalogEntry& y) {return x.toss_time < y.toss_time;};
+        priority_queue<CatalogEntry, vector<CatalogEntry>, decltype(older)> newest(older);
+        vector<bool> exhausted(tails.size(), false);
+        for (size_t shown = 0; shown < end; ) {
+            // the tail whose unread entries may be the most recent
+            size_t next = tails.size();
+            for (size_t i = 0; i < tails.size(); ++i) {
+                if (exhausted[i]) continue;
+                if (next == tails.size() || tails[i].tossedBy() > tails[next].tossedBy()) next = i;
+            }
+            if (!newest.empty() && (next == tails.size() || newest.top().toss_time >= tails[next].tossedBy())) {
+                if (shown++ >= offset) {
+                    const CatalogEntry& entry = newest.top();
+                    row(entry.toss_time, entry.type == 'd' ? entry.original + "/" : entry.original, entry.size);
+                }
+                newest.pop();
+                continue;
+            }
+            if (next == tails.size()) break;
+
+            CatalogEntry entry;
+            if (!tails[next].next(entry)) exhausted[next] = true;
+            else if (selected(entry)) newest.push(move(entry));
+        }
+        return;
+    }
+
+    // by name or size: every item has to be seen, but only the offset + limit first
+    // ones are kept, in a heap whose top is the one to drop next
+    Listing files(order == ByName ? Listing::ByName : Listing::BySize, end);
+    CatalogEntry entry;
+    {
+        Phase reading("read catalogs");
+        for (auto& tail: tails) {
+            while (tail.next(entry)) {
+                if (selected(entry)) files.add(entry);
+            }
+        }
+    }
+
+    const vector<uint32_t>* ordered;
+    {
+        Phase sorting("sort");
+        ordered = &files.ordered();
+    }
+
+    Phase printing("print");
+    for (size_t i = offset; i < ordered->size(); ++i) row(files.time((*ordered)[i]), files.path((*ordered)[i]), files.size((*ordered)[i]));
+}
+
+bool Engine::du(const string& dir, DirTotals& total, vector<pair<string, DirTotals>>& children) {
+    Phase phase("du");
+    auto add = [](DirTotals& into, const DirTotals& totals) {
+        if (into.items == 0 || totals.oldest < into.oldest) into.oldest = totals.oldest;
+        into.bytes += totals.bytes;
+        into.items += totals.items;
+    };
+
+    // every bin may hold items from below dir
+    total = DirTotals();
+    map<string, DirTotals> below;
+    for (const auto& bin: registry->all()) {
+        DirTotals totals;
+        vector<pair<string, DirTotals>> found;
+        if (!registry->catalogFor(bin).du(dir, totals, found)) continue;
+        add(total, totals);
+        for (const auto& child: found) add(below[child.first], child.second);
+    }
+
+    children.assign(below.begin(), below.end());
+    sort(children.begin(), children.end(), [](const auto &x, const auto &y) {return x.second.bytes > y.second.bytes;});
+    return total.items > 0;
+}
+
+/** Maintenance **/
+
+size_t Engine::rebuildCatalogs() {
+    Phase phase("rebuild catalog");
+    size_t count = 0;
+    for (const auto& bin: registry->all()) count += registry->catalogFor(bin).rebuild();
+    return count;
+}
+
+PurgeResult Engine::purge(long cutoff) {
+    Phase phase("purge");
+    PurgeResult purged;
+    for (const auto& bin: registry->all()) {
+        PurgeResult result = purgeBin(bin, registry->catalogFor(bin), cutoff);
+        purged.bytes += result.bytes;
+        purged.files += result.files;
+    }
+    return purged;
+}
+
+uintmax_t Engine::quota() const {
+    return loadConfig(recycledir).quota;
+}
+
+void Engine::setQuota(uintmax_t bytes) {
+    Config config = loadConfig(recycledir);
+    config.quota = bytes;
+    saveConfig(recycledir, config);
+}
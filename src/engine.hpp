@@ -0,0 +1,171 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <set>
+#include <functional>
+#include <cstdint>
+#include <sys/stat.h>
+
+#include "toss.hpp"
+#include "catalog.hpp"
+#include "bins.hpp"
+#include "history.hpp"
+#include "journal.hpp"
+#include "executor.hpp"
+#include "objects.hpp"
+#include "move.hpp"
+#include "purge.hpp"
+#include "select.hpp"
+
+// one toss or recover, bin is the recycle bin the item is stored in, entry the version being recovered
+struct TossMove {
+    std::string src;
+    std::string dest;
+    std::string bin;
+    CatalogEntry entry;
+    int statResult = 1;     // lstat of src through the executor, 0 or -errno
+    struct statx info;
+    ino_t replaced = 0;     // recovering: inode of what is in the way at dest, 0 if nothing
+    uintmax_t files = 0;    // directories: regular files below src
+    bool copied = false;    // lands on another filesystem, so is copied rather than renamed (see Engine::describe)
+};
+
+struct PlanOptions {
+    bool recover = false;
+    bool recursive = false;     // take directories, whole
+    int revision = 0;           // recover this version (1 is the oldest) instead of the newest
+    long time = 0;              // toss time recorded for the items, 0 for now
+    std::string cwd;            // relative paths are resolved against it, the current directory if empty
+    bool hash = true;           // start hashing a toss's files right away, left to execute() if not
+};
+
+// a batch of tosses or recovers resolved by Engine::plan(), nothing moved yet
+struct Plan {
+    bool recover = false;
+    long time = 0;
+    std::vector<TossMove> files;
+    std::vector<TossMove> dirs;
+    std::unique_ptr<HashAhead> hashes;      // tossing: the files' hashes, started by plan() or execute()
+};
+
+// what executing a plan would do, worked out by Engine::describe() without changing anything
+struct PlanReport {
+    uintmax_t files = 0;                    // regular files moved, counting those in directories
+    uintmax_t bytes = 0;
+    uintmax_t copiedBytes = 0;              // of which copied across filesystems
+    std::vector<std::string> replaced;      // files in the way, see Engine::conflicts()
+    std::vector<std::string> created;       // directories made for the destinations, parents first
+};
+
+// relative to cwd, with "." and ".." (as in find's "./dir/file") resolved without touching the disk
+std::string absolutePath(const std::string& cwd, const std::string& input);
+
+// called with each row of a listing; directories tossed whole come with a trailing "/"
+using ListRow = std::function<void(long time, std::string_view path, uintmax_t size)>;
+
+/**
+ * libtoss (bin/libtoss.a): what the toss command does, as calls for programs embedding it;
+ * main.cpp is the command line on top of it
+ * - every call returns its result or throws toss_exception (filesystem::filesystem_error for
+ *   failed file operations), nothing is printed and the process is never exited
+ * - tossing and recovering take two steps: plan() resolves a batch of paths (a statx batch and
+ *   catalog lookups, and for a toss starts hashing the files on other threads) without moving
+ *   anything, execute() journals the batch, moves it and commits its catalog records; a toss
+ *   can be planned while the batch before it is still being used, a recover is planned from
+ *   the catalogs and so after the batches before it were executed
+ * - a batch that fails midway keeps what it moved: its records are committed and the error
+ *   thrown, as the command line would stop there
+ * An engine is not thread safe, and its journal is named after the process (see journal.hpp),
+ * so a process executes batches through one engine at a time.
+ */
+class Engine {
+private:
+    std::string recycledir;
+    std::unique_ptr<BinRegistry> registry;
+    ReplayResult replay;
+    std::unique_ptr<Executor> executor;
+    std::unique_ptr<Journal> journal;
+    std::unique_ptr<History> versions;
+    std::set<std::string> touched;      // bins tossed into since the last enforceQuota()
+    ObjectStores stores;                // what this engine learned of each bin's store
+
+    void abandonBatch();
+    void planRecover(const std::string& dest, const PlanOptions& options, std::vector<TossMove>& unsorted);
+    void hashFiles(Plan& plan);
+    void journalBatch(Plan& plan);
+    void storeFiles(Plan& plan, uintmax_t& count);
+    void moveDirs(Plan& plan, const ConfirmReplace& confirm, uintmax_t& count);
+    void recoverFiles(Plan& plan, const ConfirmReplace& confirm, uintmax_t& count);
+
+public:
+    // opens (creating it if needed) the home recycle bin and the bins registered in it, and
+    // settles what tosses killed midway left behind
+    Engine(const std::string& recycledir);
+    ~Engine();
+
+    BinRegistry& bins() { return *registry; }
+
+    // moves of interrupted tosses finished and rolled back when the engine was opened
+    const ReplayResult& replayed() const { return replay; }
+
+    /** Toss and Recover **/
+
+    // paths: files or directories to toss, or original paths to recover
+    Plan plan(const std::vector<std::string>& paths, const PlanOptions& options);
+
+    // every file recovering the batch would replace, in the order execute() asks about them: the
+    // files in the way and, for directories merged into existing ones, the files below them
+    std::vector<std::string> conflicts(const Plan& plan);
+
+    // conflicts, copies across filesystems, bytes moved and directories created, in one batch of
+    // stats of where the items land; marks the items that are copied
+    PlanReport describe(Plan& plan);
+
+    // move a planned batch, returns the number of files moved (counting those in directories)
+    // confirm: asked before a recover replaces a file, none to replace without asking; a "no"
+    // throws toss_canceled
+    uintmax_t execute(Plan& plan, const ConfirmReplace& confirm = {});
+
+    // make room under the quota after tossing, oldest items first, never those tossed at or
+    // after keepFrom
+    PurgeResult enforceQuota(long keepFrom);
+
+    /** History **/
+
+    // read the versions of the paths starting with one of the prefixes, all of them if empty;
+    // done on demand (with every path) otherwise. execute() keeps it current: a recover drops
+    // the versions it moved out, a toss (or a failed batch) has it read again on demand
+    void loadHistory(const std::vector<std::string>& prefixes = {});
+
+    // oldest first
+    std::vector<Version> versionsOf(const std::string& path);
+
+    // the original paths matching any of the patterns
+    std::vector<std::string> matching(const std::vector<Pattern>& patterns);
+
+    /** Listing **/
+
+    enum ListOrder { Recent, ByName, BySize };
+
+    // the live items of every bin matching one of the patterns (all of them without any), in
+    // order, skipping the first offset and stopping after limit
+    void list(ListOrder order, size_t offset, size_t limit, const std::vector<Pattern>& patterns, const ListRow& row);
+
+    // totals of what was tossed from below dir and from each of its subdirectories (largest
+    // first), over every bin; false if nothing was
+    bool du(const std::string& dir, DirTotals& total, std::vector<std::pair<std::string, DirTotals>>& children);
+
+    /** Maintenance **/
+
+    // rewrite every bin's catalog from what is on disk, returns the number of entries
+    size_t rebuildCatalogs();
+
+    // delete items tossed at or before cutoff from every bin
+    PurgeResult purge(long cutoff);
+
+    // bytes each bin is kept under, 0 for no limit
+    uintmax_t quota() const;
+    void setQuota(uintmax_t bytes);
+};
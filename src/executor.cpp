@@ -0,0 +1,252 @@
+#include "executor.hpp"
+#include "toss.hpp"
+#include "stats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+using namespace std;
+
+// split ops into waves, each op one wave after the op it depends on
+static vector<vector<size_t>> waves(const vector<FsOp>& ops) {
+    vector<size_t> level(ops.size(), 0);
+    vector<vector<size_t>> result;
+    for (size_t i = 0; i < ops.size(); ++i) {
+        long after = ops[i].after;
+        if (after >= 0 && (size_t)after < i) level[i] = level[after] + 1;
+        if (result.size() <= level[i]) result.resize(level[i] + 1);
+        result[level[i]].push_back(i);
+    }
+    return result;
+}
+
+// the blocking equivalent of one op
+static void runNow(FsOp& op) {
+    int status = 0;
+    switch (op.kind) {
+        case FsOp::Stat:
+            status = statx(AT_FDCWD, op.path.c_str(), AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, op.mask, &op.info);
+            break;
+        case FsOp::Mkdir:
+            status = mkdir(op.path.c_str(), op.mode);
+            break;
+        case FsOp::Rename:
+            status = renameat2(AT_FDCWD, op.path.c_str(), AT_FDCWD, op.target.c_str(), op.flags);
+            break;
+        case FsOp::Unlink:
+            status = unlink(op.path.c_str());
+            break;
+    }
+    op.result = status == 0 ? 0 : -errno;
+}
+
+namespace {
+
+/** Thread Pool **/
+
+// metadata ops on network filesystems wait on round trips, not CPU, so more threads than CPUs
+class PoolExecutor : public Executor {
+private:
+    unsigned threads;
+
+public:
+    PoolExecutor(unsigned threads):threads(threads){}
+
+    void run(vector<FsOp>& ops) override {
+        if (ops.empty()) return;
+        Phase phase("executor batch");
+        statsCount("executor ops", ops.size());
+        for (const auto& wave: waves(ops)) {
+            if (wave.size() == 1) {
+                runNow(ops[wave[0]]);
+                continue;
+            }
+            atomic<size_t> next{0};
+            auto work = [&]() {
+                for (size_t i; (i = next.fetch_add(1)) < wave.size(); ) runNow(ops[wave[i]]);
+            };
+            vector<thread> pool;
+            unsigned count = min<size_t>(threads, wave.size());
+            for (unsigned t = 1; t < count; ++t) pool.emplace_back(work);
+            work();
+            for (auto& t: pool) t.join();
+        }
+    }
+
+    const char* name() const override { return "threads"; }
+};
+
+/** io_uring **/
+
+int ringSetup(unsigned entries, io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+int ringEnter(int fd, unsigned submit, unsigned wait) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+}
+
+// a submission and completion ring driven straight through the syscalls, no liburing needed
+class RingExecutor : public Executor {
+private:
+    int fd = -1;
+    io_uring_params params{};
+    void* sqRing = MAP_FAILED;
+    void* cqRing = MAP_FAILED;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    io_uring_cqe* cqes;
+
+    template <typename T> T* at(void* base, unsigned offset) {
+        return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+
+    bool supports(const vector<int>& opcodes) {
+        vector<char> buf(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+        auto probe = reinterpret_cast<io_uring_probe*>(buf.data());
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) != 0) return false;
+        for (int op: opcodes) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) return false;
+        }
+        return true;
+    }
+
+    void prepare(io_uring_sqe* sqe, FsOp& op, size_t index) {
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uint64_t>(op.path.c_str());
+        sqe->user_data = index;
+        switch (op.kind) {
+            case FsOp::Stat:
+                sqe->opcode = IORING_OP_STATX;
+                sqe->len = op.mask;
+                sqe->statx_flags = AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC;
+                sqe->addr2 = reinterpret_cast<uint64_t>(&op.info);
+                break;
+            case FsOp::Mkdir:
+                sqe->opcode = IORING_OP_MKDIRAT;
+                sqe->len = op.mode;
+                break;
+            case FsOp::Rename:
+                sqe->opcode = IORING_OP_RENAMEAT;
+                sqe->len = AT_FDCWD;
+                sqe->addr2 = reinterpret_cast<uint64_t>(op.target.c_str());
+                sqe->rename_flags = op.flags;
+                break;
+            case FsOp::Unlink:
+                sqe->opcode = IORING_OP_UNLINKAT;
+                break;
+        }
+    }
+
+    // submit one wave, keeping the ring full, and collect every completion
+    void runWave(vector<FsOp>& ops, const vector<size_t>& wave) {
+        size_t queued = 0;
+        size_t inFlight = 0;        // queued and not yet completed, never more than the ring holds
+        unsigned unsubmitted = 0;   // queued but not yet taken by the kernel
+        size_t done = 0;
+        while (done < wave.size()) {
+            unsigned tail = *sqTail;
+            while (queued < wave.size() && inFlight < params.sq_entries) {
+                unsigned slot = tail & *sqMask;
+                prepare(&sqes[slot], ops[wave[queued]], wave[queued]);
+                sqArray[slot] = slot;
+                ++tail;
+                ++queued;
+                ++inFlight;
+                ++unsubmitted;
+            }
+            __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+            int submitted = ringEnter(fd, unsubmitted, 1);
+            if (submitted >= 0) {
+                unsubmitted -= submitted;
+            } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                throw toss_exception(string("io_uring submission failed: ") + strerror(errno));
+            }
+
+            unsigned head = *cqHead;
+            unsigned ready = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != ready; ++head) {
+                const io_uring_cqe& cqe = cqes[head & *cqMask];
+                ops[cqe.user_data].result = cqe.res < 0 ? cqe.res : 0;
+                --inFlight;
+                ++done;
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+    }
+
+public:
+    RingExecutor() {
+        fd = ringSetup(256, &params);
+        if (fd < 0) return;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) return;
+        cqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? sqRing
+            : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) return;
+        void* sqeMap = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqeMap == MAP_FAILED) return;
+        sqes = static_cast<io_uring_sqe*>(sqeMap);
+
+        sqTail = at<unsigned>(sqRing, params.sq_off.tail);
+        sqMask = at<unsigned>(sqRing, params.sq_off.ring_mask);
+        sqArray = at<unsigned>(sqRing, params.sq_off.array);
+        cqHead = at<unsigned>(cqRing, params.cq_off.head);
+        cqTail = at<unsigned>(cqRing, params.cq_off.tail);
+        cqMask = at<unsigned>(cqRing, params.cq_off.ring_mask);
+        cqes = at<io_uring_cqe>(cqRing, params.cq_off.cqes);
+    }
+
+    ~RingExecutor() {
+        if (sqes != MAP_FAILED) munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+        if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+        if (fd >= 0) close(fd);
+    }
+
+    // set up, mapped, and every opcode we issue is known to the kernel
+    bool usable() {
+        return sqes != MAP_FAILED && supports({IORING_OP_STATX, IORING_OP_MKDIRAT, IORING_OP_RENAMEAT, IORING_OP_UNLINKAT});
+    }
+
+    void run(vector<FsOp>& ops) override {
+        if (ops.empty()) return;
+        Phase phase("executor batch");
+        statsCount("executor ops", ops.size());
+        for (const auto& wave: waves(ops)) {
+            if (wave.size() == 1) runNow(ops[wave[0]]);
+            else runWave(ops, wave);
+        }
+    }
+
+    const char* name() const override { return "io_uring"; }
+};
+
+}
+
+unique_ptr<Executor> makeExecutor() {
+    auto ring = make_unique<RingExecutor>();
+    if (ring->usable()) return ring;
+    return make_unique<PoolExecutor>(16);
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <sys/stat.h>
+#include <stdio.h>
+
+// one metadata operation for an Executor, paths are absolute
+struct FsOp {
+    enum Kind { Stat, Mkdir, Rename, Unlink };
+    Kind kind;
+    std::string path;           // the file to stat / create / unlink, or the rename source
+    std::string target;         // rename destination
+    mode_t mode = 0;            // mkdir mode
+    long after = -1;            // index of an earlier op that must finish before this one starts
+    int result = 0;             // 0, or -errno once run
+    struct statx info;          // Stat: lstat-like result (no symlinks followed)
+    unsigned mask = STATX_BASIC_STATS;      // Stat: the fields wanted in info
+    unsigned flags = 0;                     // Rename: renameat2 flags
+
+    // stats pass AT_STATX_DONT_SYNC: a network filesystem answers from its attribute cache
+    // instead of a round trip per file (local ones are always current anyway)
+    static FsOp statPath(std::string path, unsigned mask = STATX_BASIC_STATS) {
+        FsOp op{Stat, std::move(path), "", 0, -1};
+        op.mask = mask;
+        return op;
+    }
+    static FsOp makeDir(std::string path, mode_t mode) { return {Mkdir, std::move(path), "", mode, -1}; }
+    static FsOp renamePath(std::string from, std::string to, long after = -1) { return {Rename, std::move(from), std::move(to), 0, after}; }
+    // fails with EEXIST rather than replace what is at to (EINVAL where the filesystem cannot tell)
+    static FsOp renameNoReplace(std::string from, std::string to, long after = -1) {
+        FsOp op{Rename, std::move(from), std::move(to), 0, after};
+        op.flags = RENAME_NOREPLACE;
+        return op;
+    }
+    static FsOp unlinkPath(std::string path, long after = -1) { return {Unlink, std::move(path), "", 0, after}; }
+};
+
+/**
+ * Runs batches of renames, mkdirs, unlinks and stats without waiting on each one in turn.
+ * Ops are issued in waves: everything whose dependency (after) has finished goes out together,
+ * so a parent directory is created before the renames into it while unrelated ops overlap.
+ * Each op's outcome is left in its result; an op still runs when its dependency failed.
+ */
+class Executor {
+public:
+    virtual ~Executor() = default;
+    virtual void run(std::vector<FsOp>& ops) = 0;
+    virtual const char* name() const = 0;
+};
+
+// io_uring (statx / mkdirat / renameat / unlinkat) when the kernel allows it, else a thread pool
+std::unique_ptr<Executor> makeExecutor();
@@ -0,0 +1,282 @@
+#include "hash.hpp"
+#include "toss.hpp"
+
+#include <algorithm>
+#include <array>
+#include <vector>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+namespace {
+
+constexpr uint64_t PRIME32_1 = 0x9E3779B1U;
+constexpr uint64_t PRIME32_2 = 0x85EBCA77U;
+constexpr uint64_t PRIME32_3 = 0xC2B2AE3DU;
+constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+constexpr size_t STRIPE = 64;
+constexpr size_t STRIPES_PER_BLOCK = Hasher::BLOCK / STRIPE;
+
+// stripe s of a block uses secret words [s, s + 8), the scramble uses [16, 24)
+constexpr array<uint64_t, 24> makeSecret() {
+    array<uint64_t, 24> secret{};
+    uint64_t state = PRIME64_1;
+    for (auto& word: secret) {
+        // splitmix64
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        word = z ^ (z >> 31);
+    }
+    return secret;
+}
+
+constexpr array<uint64_t, 24> SECRET = makeSecret();
+
+inline uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;   // little endian hosts only, like everything else toss runs on
+}
+
+inline void accumulateStripe(uint64_t* acc, const unsigned char* stripe, const uint64_t* key) {
+    for (int i = 0; i < 8; ++i) {
+        uint64_t data = read64(stripe + 8 * i);
+        uint64_t mixed = data ^ key[i];
+        acc[i ^ 1] += data;
+        acc[i] += (mixed & 0xFFFFFFFFULL) * (mixed >> 32);
+    }
+}
+
+inline void scramble(uint64_t* acc) {
+    for (int i = 0; i < 8; ++i) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= SECRET[16 + i];
+        acc[i] = a * PRIME32_1;
+    }
+}
+
+/** Block Kernels **/
+// each consumes whole blocks (stripes plus scramble) and must give bit for bit the same lanes
+
+void processBlocksScalar(uint64_t* acc, const unsigned char* p, size_t blocks) {
+    for (; blocks > 0; --blocks, p += Hasher::BLOCK) {
+        for (size_t s = 0; s < STRIPES_PER_BLOCK; ++s) {
+            accumulateStripe(acc, p + s * STRIPE, SECRET.data() + s);
+        }
+        scramble(acc);
+    }
+}
+
+#if defined(__x86_64__)
+
+// SSE2 is part of x86-64, two lanes per register; every instruction the lanes need (64-bit
+// adds and shifts, the 32x32->64 pmuludq multiply) is SSE2, so SSE4.2 (its CRC32 and string
+// instructions) would add nothing but CPUs it cannot run on
+void processBlocksSse2(uint64_t* acc, const unsigned char* p, size_t blocks) {
+    __m128i a[4];
+    for (int i = 0; i < 4; ++i) a[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc) + i);
+    const __m128i prime = _mm_set1_epi32((int)PRIME32_1);
+
+    for (; blocks > 0; --blocks, p += Hasher::BLOCK) {
+        for (size_t s = 0; s < STRIPES_PER_BLOCK; ++s) {
+            auto data = reinterpret_cast<const __m128i*>(p + s * STRIPE);
+            auto key = reinterpret_cast<const __m128i*>(SECRET.data() + s);
+            for (int i = 0; i < 4; ++i) {
+                __m128i d = _mm_loadu_si128(data + i);
+                __m128i dk = _mm_xor_si128(d, _mm_loadu_si128(key + i));
+                __m128i product = _mm_mul_epu32(dk, _mm_srli_epi64(dk, 32));
+                __m128i swapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+                a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, swapped));
+            }
+        }
+        auto key = reinterpret_cast<const __m128i*>(SECRET.data() + 16);
+        for (int i = 0; i < 4; ++i) {
+            __m128i x = _mm_xor_si128(_mm_xor_si128(a[i], _mm_srli_epi64(a[i], 47)), _mm_loadu_si128(key + i));
+            __m128i lo = _mm_mul_epu32(x, prime);
+            __m128i hi = _mm_mul_epu32(_mm_srli_epi64(x, 32), prime);
+            a[i] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+        }
+    }
+    for (int i = 0; i < 4; ++i) _mm_storeu_si128(reinterpret_cast<__m128i*>(acc) + i, a[i]);
+}
+
+__attribute__((target("avx2")))
+void processBlocksAvx2(uint64_t* acc, const unsigned char* p, size_t blocks) {
+    __m256i a[2];
+    for (int i = 0; i < 2; ++i) a[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc) + i);
+    const __m256i prime = _mm256_set1_epi32((int)PRIME32_1);
+
+    for (; blocks > 0; --blocks, p += Hasher::BLOCK) {
+        for (size_t s = 0; s < STRIPES_PER_BLOCK; ++s) {
+            auto data = reinterpret_cast<const __m256i*>(p + s * STRIPE);
+            auto key = reinterpret_cast<const __m256i*>(SECRET.data() + s);
+            for (int i = 0; i < 2; ++i) {
+                __m256i d = _mm256_loadu_si256(data + i);
+                __m256i dk = _mm256_xor_si256(d, _mm256_loadu_si256(key + i));
+                __m256i product = _mm256_mul_epu32(dk, _mm256_srli_epi64(dk, 32));
+                __m256i swapped = _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+                a[i] = _mm256_add_epi64(a[i], _mm256_add_epi64(product, swapped));
+            }
+        }
+        auto key = reinterpret_cast<const __m256i*>(SECRET.data() + 16);
+        for (int i = 0; i < 2; ++i) {
+            __m256i x = _mm256_xor_si256(_mm256_xor_si256(a[i], _mm256_srli_epi64(a[i], 47)), _mm256_loadu_si256(key + i));
+            __m256i lo = _mm256_mul_epu32(x, prime);
+            __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(x, 32), prime);
+            a[i] = _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+        }
+    }
+    for (int i = 0; i < 2; ++i) _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc) + i, a[i]);
+}
+
+#endif
+
+using BlockKernel = void (*)(uint64_t*, const unsigned char*, size_t);
+
+struct Kernel {
+    BlockKernel run;
+    const char* name;
+};
+
+// every kernel this CPU can run, fastest first
+vector<Kernel> usableKernels() {
+    vector<Kernel> kernels;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) kernels.push_back({processBlocksAvx2, "avx2"});
+    kernels.push_back({processBlocksSse2, "sse2"});
+#endif
+    kernels.push_back({processBlocksScalar, "scalar"});
+    return kernels;
+}
+
+// picked once from what the CPU supports, see useHashKernel
+Kernel KERNEL = usableKernels().front();
+
+inline uint64_t mix(uint64_t a, uint64_t b) {
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+inline uint64_t avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+}
+
+string Hash128::hex() const {
+    static const char digits[] = "0123456789abcdef";
+    string out(32, '0');
+    for (int i = 0; i < 16; ++i) {
+        out[15 - i] = digits[(hi >> (4 * i)) & 0xF];
+        out[31 - i] = digits[(lo >> (4 * i)) & 0xF];
+    }
+    return out;
+}
+
+Hasher::Hasher():acc{PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1}{}
+
+void Hasher::update(const void* data, size_t size) {
+    auto p = static_cast<const unsigned char*>(data);
+    length += size;
+
+    // a block is only consumed once more data follows it, the last one always goes to digest,
+    // so the hash does not depend on how the input was split into updates
+    while (size > 0) {
+        if (buffered == BLOCK) {
+            KERNEL.run(acc, buffer, 1);
+            buffered = 0;
+        }
+        if (buffered == 0 && size > BLOCK) {
+            size_t blocks = (size - 1) / BLOCK;
+            KERNEL.run(acc, p, blocks);
+            p += blocks * BLOCK;
+            size -= blocks * BLOCK;
+        }
+        size_t take = min(size, BLOCK - buffered);
+        memcpy(buffer + buffered, p, take);
+        buffered += take;
+        p += take;
+        size -= take;
+    }
+}
+
+Hash128 Hasher::digest() const {
+    uint64_t state[8];
+    memcpy(state, acc, sizeof(state));
+
+    // the final block: whole stripes, then the zero padded rest, without a scramble
+    size_t s = 0;
+    for (; (s + 1) * STRIPE <= buffered; ++s) {
+        accumulateStripe(state, buffer + s * STRIPE, SECRET.data() + s);
+    }
+    if (s * STRIPE < buffered) {
+        unsigned char last[STRIPE] = {};
+        memcpy(last, buffer + s * STRIPE, buffered - s * STRIPE);
+        accumulateStripe(state, last, SECRET.data() + s);
+    }
+
+    Hash128 hash;
+    hash.lo = length * PRIME64_1;
+    hash.hi = ~length * PRIME64_2;
+    for (int i = 0; i < 4; ++i) {
+        hash.lo += mix(state[2 * i] ^ SECRET[i], state[2 * i + 1] ^ SECRET[i + 4]);
+        hash.hi += mix(state[2 * i] ^ SECRET[i + 8], state[2 * i + 1] ^ SECRET[i + 12]);
+    }
+    hash.lo = avalanche(hash.lo);
+    hash.hi = avalanche(hash.hi);
+    return hash;
+}
+
+const char* hashKernel() {
+    return KERNEL.name;
+}
+
+vector<string> hashKernels() {
+    vector<string> names;
+    for (const auto& kernel: usableKernels()) names.push_back(kernel.name);
+    return names;
+}
+
+bool useHashKernel(const string& name) {
+    for (const auto& kernel: usableKernels()) {
+        if (name == kernel.name) {
+            KERNEL = kernel;
+            return true;
+        }
+    }
+    return false;
+}
+
+Hash128 hashFd(int fd, uintmax_t& size, uintmax_t expected) {
+    constexpr size_t CHUNK = 1 << 20;
+    Hasher hasher;
+    if (expected > CHUNK) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    vector<unsigned char> buf(min<uintmax_t>(CHUNK, max<uintmax_t>(expected, 1)));
+    size = 0;
+    while (size < expected) {
+        ssize_t n = read(fd, buf.data(), min<uintmax_t>(buf.size(), expected - size));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw toss_exception(string("cannot read file to hash: ") + strerror(errno));
+        }
+        if (n == 0) break;
+        hasher.update(buf.data(), n);
+        size += n;
+    }
+    return hasher.digest();
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// 128-bit content hash, names objects in the recycle bin's object store
+struct Hash128 {
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+    std::string hex() const;
+};
+
+/**
+ * Streaming content hash in the style of XXH3: eight 64-bit lanes take 64-byte stripes
+ * (acc[i ^ 1] += data, acc[i] += lo32(data ^ key) * hi32(data ^ key)), every 1KB block is
+ * scrambled, and the lanes are folded into 128 bits together with the length.
+ * Whole blocks go through an AVX2, SSE2 or scalar kernel picked at startup from the CPU's
+ * features; all of them give the same result, which is part of the on-disk format and must
+ * never change.
+ */
+class Hasher {
+private:
+    uint64_t acc[8];
+    unsigned char buffer[1024];
+    size_t buffered = 0;
+    uint64_t length = 0;
+
+public:
+    static constexpr size_t BLOCK = 1024;
+
+    Hasher();
+    void update(const void* data, size_t size);
+    Hash128 digest() const;
+};
+
+// name of the block kernel in use: "avx2", "sse2" or "scalar"
+const char* hashKernel();
+
+// the kernels this CPU can run, the one picked at startup first
+std::vector<std::string> hashKernels();
+
+// hash with the named kernel from now on, false if this CPU cannot run it; for toss-hashcheck,
+// which checks every kernel against the same digests, and not safe while anything is hashing
+bool useHashKernel(const std::string& name);
+
+// hash an open file from its current offset to the end, size receives the number of bytes read
+// expected: the size fstat gave, if known; reading stops there rather than on a read() returning
+// nothing, and a file read in one go gets no readahead advice
+Hash128 hashFd(int fd, uintmax_t& size, uintmax_t expected = UINTMAX_MAX);
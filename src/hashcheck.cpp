@@ -0,0 +1,95 @@
+/**
+ * toss-hashcheck: checks the content hash against fixed digests, for `make test`
+ *
+ * Object names in every recycle bin are these digests, so they must never change. Every input
+ * is hashed with each block kernel this CPU can run (avx2, sse2 and the scalar one x86 never
+ * picks on its own), in one update and in uneven pieces, and each result compared with the
+ * digest written down below. Exits 1 after printing every mismatch.
+ */
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "hash.hpp"
+using namespace std;
+
+struct Golden {
+    size_t length;
+    const char* digest;
+};
+
+// lengths around the stripe (64 bytes) and block (1KB) edges, and a few blocks long
+static const Golden GOLDEN[] = {
+    {0, "71bf84c1c709e089995fdc350849f685"},
+    {1, "13e3ff0c3949ad34316a48d4bdf8463d"},
+    {3, "8eceb0f13eed14be1085b7d0bfbd76ca"},
+    {8, "f735e00b2d68f1c4515c2f9d94ad2a7e"},
+    {63, "e3e22398aec4828cd8d2ef77bec346bc"},
+    {64, "ad550258c118280831c873267631da6c"},
+    {65, "1ba280076e85aa2c40350bbe1183d82b"},
+    {1023, "b253b1e9cb930e28bf41b2234ffb7818"},
+    {1024, "d93c51080e4a9cf29a3821c9ea1bfb33"},
+    {1025, "86d21aec5a351f11ef7d40c899dc9aae"},
+    {2047, "3f1563068e80fcdcd2eb3ebe55e676fb"},
+    {2048, "0beb872db08212ce3eb460c68b1155a7"},
+    {4104, "efbf89308135bf5490349c2857968ef8"},
+    {65553, "4eeeaa0862133607e7fc72572e7f9c6a"},
+    {1000003, "a3df1a676f51d86c37334f58204bd71d"},
+};
+
+// the same bytes on every run and every machine
+static vector<unsigned char> input(size_t length) {
+    vector<unsigned char> data(length);
+    uint64_t state = 0x9E3779B97F4A7C15ULL ^ length;
+    for (auto& byte: data) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        byte = (unsigned char)(state >> 56);
+    }
+    return data;
+}
+
+static string digestOf(const vector<unsigned char>& data, size_t piece) {
+    Hasher hasher;
+    for (size_t done = 0; done < data.size(); done += min(piece, data.size() - done)) {
+        hasher.update(data.data() + done, min(piece, data.size() - done));
+    }
+    return hasher.digest().hex();
+}
+
+int main(int argc, char** argv) {
+    // --print writes the table with the scalar kernel, for adding lengths
+    if (argc > 1 && string(argv[1]) == "--print") {
+        useHashKernel("scalar");
+        for (const auto& golden: GOLDEN) {
+            cout << "    {" << golden.length << ", \"" << digestOf(input(golden.length), SIZE_MAX) << "\"},\n";
+        }
+        return 0;
+    }
+
+    int failures = 0;
+    size_t checked = 0;
+    for (const auto& kernel: hashKernels()) {
+        useHashKernel(kernel);
+        for (const auto& golden: GOLDEN) {
+            auto data = input(golden.length);
+            for (size_t piece: {SIZE_MAX, (size_t)7, (size_t)1000, (size_t)4096}) {
+                string digest = digestOf(data, piece);
+                ++checked;
+                if (digest == golden.digest) continue;
+                cerr << kernel << ": " << golden.length << " bytes";
+                if (piece != SIZE_MAX) cerr << " in pieces of " << piece;
+                cerr << " hash to " << digest << ", expected " << golden.digest << endl;
+                ++failures;
+            }
+        }
+    }
+    if (failures > 0) return 1;
+    cout << "hash: " << checked << " digests match (";
+    for (const auto& kernel: hashKernels()) cout << (kernel == hashKernels().front() ? "" : ", ") << kernel;
+    cout << ")" << endl;
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "history.hpp"
+#include "toss.hpp"
+
+#include <algorithm>
+#include <set>
+#include <sys/stat.h>
+using namespace std;
+
+History::History(BinRegistry& bins, const vector<string>& prefixes) {
+    for (const auto& bin: bins.all()) {
+        CatalogTail tail = bins.catalogFor(bin).tail();
+        tail.restrict(prefixes);
+        vector<CatalogEntry> entries;
+        for (CatalogEntry entry; tail.next(entry); ) entries.push_back(entry);
+
+        // oldest first, as load() gives them, so versions tossed at the same time keep their order
+        for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+            string original = it->original;
+            byOriginal.emplace(move(original), make_pair(bin, move(*it)));
+        }
+    }
+}
+
+vector<Version> History::versionsOf(const string& original) const {
+    vector<Version> versions;
+
+    // tossed from this very path
+    auto range = byOriginal.equal_range(original);
+    for (auto it = range.first; it != range.second; ++it) {
+        const auto& bin = it->second.first;
+        const auto& entry = it->second.second;
+        versions.push_back({bin, entry, bin + entry.stored});
+    }
+
+    // inside a directory tossed from one of its ancestors, if the directory still holds it
+    string ancestor = original;
+    for (size_t slash; (slash = ancestor.rfind('/')) != string::npos && slash > 0; ) {
+        ancestor.erase(slash);
+        string suffix = original.substr(ancestor.size());
+        auto dirs = byOriginal.equal_range(ancestor);
+        for (auto it = dirs.first; it != dirs.second; ++it) {
+            const auto& bin = it->second.first;
+            const auto& entry = it->second.second;
+            if (entry.type != 'd') continue;
+
+            string source = bin + entry.stored + suffix;
+            struct stat info;
+            if (lstat(source.c_str(), &info) != 0) continue;
+            CatalogEntry inner(entry.toss_time, S_ISDIR(info.st_mode) ? 0 : info.st_size, original, entry.stored + suffix, S_ISDIR(info.st_mode) ? 'd' : 'f');
+            versions.push_back({bin, inner, source});
+        }
+    }
+
+    stable_sort(versions.begin(), versions.end(), [](const auto &x, const auto &y) {return x.entry.toss_time < y.entry.toss_time;});
+    return versions;
+}
+
+vector<Version> History::latestBelow(const string& dir) const {
+    vector<Version> latest;
+    string prefix = dir + "/";
+    for (auto it = byOriginal.lower_bound(prefix); it != byOriginal.end() && startsWith(it->first, prefix); ) {
+        // entries for one path are adjacent, keep the newest
+        auto newest = it;
+        for (++it; it != byOriginal.end() && it->first == newest->first; ++it) {
+            if (it->second.second.toss_time >= newest->second.second.toss_time) newest = it;
+        }
+        const auto& bin = newest->second.first;
+        const auto& entry = newest->second.second;
+        latest.push_back({bin, entry, bin + entry.stored});
+    }
+    return latest;
+}
+
+void History::forget(const string& bin, const CatalogEntry& entry) {
+    auto range = byOriginal.equal_range(entry.original);
+    for (auto it = range.first; it != range.second; ) {
+        const auto& version = it->second;
+        bool same = version.first == bin && version.second.stored == entry.stored && version.second.toss_time == entry.toss_time;
+        it = same ? byOriginal.erase(it) : next(it);
+    }
+    if (entry.type != 'd') return;
+
+    // entries merged into a tossed directory came from below the path it was tossed from
+    string prefix = entry.original + "/";
+    string inside = entry.stored + "/";
+    for (auto it = byOriginal.lower_bound(prefix); it != byOriginal.end() && startsWith(it->first, prefix); ) {
+        const auto& version = it->second;
+        bool nested = version.first == bin && startsWith(version.second.stored, inside);
+        it = nested ? byOriginal.erase(it) : next(it);
+    }
+}
+
+vector<string> History::matching(const vector<Pattern>& patterns) const {
+    set<string> found;
+    for (const auto& pattern: patterns) {
+        const string& prefix = pattern.prefix();
+        for (auto it = byOriginal.lower_bound(prefix); it != byOriginal.end() && startsWith(it->first, prefix); it = byOriginal.upper_bound(it->first)) {
+            if (pattern.matches(it->first)) found.insert(it->first);
+        }
+    }
+    return vector<string>(found.begin(), found.end());
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+
+#include "catalog.hpp"
+#include "bins.hpp"
+#include "select.hpp"
+
+// one recoverable version of a path
+struct Version {
+    std::string bin;
+    CatalogEntry entry;   // stored/original/size describe this version, even when it sits inside a tossed directory
+    std::string source;   // absolute path of the version inside the bin
+};
+
+/**
+ * Version history of every path across all recycle bins, read from their catalogs.
+ * A path's versions are the entries tossed from it plus, for paths inside a directory that was
+ * tossed whole, the copy inside that directory.
+ */
+class History {
+private:
+    std::multimap<std::string, std::pair<std::string, CatalogEntry>> byOriginal;
+
+public:
+    // prefixes: only keep the history of paths starting with one of them, all of it if empty
+    History(BinRegistry& bins, const std::vector<std::string>& prefixes = {});
+
+    // oldest first
+    std::vector<Version> versionsOf(const std::string& original) const;
+
+    // the paths items were tossed from that match any of the patterns, in order; each pattern
+    // only looks at the run of paths starting with its literal prefix
+    std::vector<std::string> matching(const std::vector<Pattern>& patterns) const;
+
+    // newest version of every path tossed on its own below dir
+    std::vector<Version> latestBelow(const std::string& dir) const;
+
+    // drop a version recovered since the history was read, and for a directory the versions
+    // stored inside it (its recover drops those from the catalog too)
+    void forget(const std::string& bin, const CatalogEntry& entry);
+};
@@ -0,0 +1,43 @@
+#include "input.hpp"
+#include "toss.hpp"
+
+#include <string.h>
+#include <unistd.h>
+using namespace std;
+
+PathReader::PathReader(int fd, char delim):fd(fd), delim(delim), buf(1 << 16){}
+
+bool PathReader::next(vector<string>& batch, size_t max) {
+    batch.clear();
+    while (batch.size() < max) {
+        char* first = buf.data() + start;
+        char* found = static_cast<char*>(memchr(first, delim, end - start));
+        if (found != nullptr) {
+            if (found != first) batch.emplace_back(first, found);
+            start = found - buf.data() + 1;
+            continue;
+        }
+
+        if (eof) {
+            // last path without a trailing delimiter
+            if (start < end) batch.emplace_back(first, end - start);
+            start = end = 0;
+            break;
+        }
+
+        // keep the partial path, growing the buffer only for paths longer than it
+        memmove(buf.data(), first, end - start);
+        end -= start;
+        start = 0;
+        if (end == buf.size()) buf.resize(buf.size() * 2);
+
+        ssize_t n = read(fd, buf.data() + end, buf.size() - end);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw toss_exception(string("cannot read paths from input: ") + strerror(errno));
+        }
+        if (n == 0) eof = true;
+        end += n;
+    }
+    return !batch.empty();
+}
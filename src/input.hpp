@@ -0,0 +1,23 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * Reads paths from a file descriptor, one per delimiter ('\0' for find -print0, '\n' otherwise),
+ * a batch at a time, so a single toss can work through millions of paths in bounded memory.
+ */
+class PathReader {
+private:
+    int fd;
+    char delim;
+    std::vector<char> buf;
+    size_t start = 0;
+    size_t end = 0;
+    bool eof = false;
+
+public:
+    PathReader(int fd, char delim);
+
+    // replace batch with up to max paths, false once the input is used up; empty paths are skipped
+    bool next(std::vector<std::string>& batch, size_t max);
+};
@@ -0,0 +1,274 @@
+#include "journal.hpp"
+#include "toss.hpp"
+#include "objects.hpp"
+#include "transfer.hpp"
+#include "stats.hpp"
+
+#include <filesystem>
+#include <vector>
+#include <map>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+using namespace std;
+
+static void append(string& out, char op, const string& bin, const CatalogEntry& entry, ino_t inode,
+                   const struct statx& moved) {
+    out += op;
+    out += '\t';
+    out += entry.type;
+    out += '\t';
+    out += to_string(entry.toss_time);
+    out += '\t';
+    out += to_string(entry.size);
+    out += '\t';
+    escapeField(out, entry.original);
+    out += '\t';
+    escapeField(out, entry.stored);
+    out += '\t';
+    escapeField(out, bin);
+    out += '\t';
+    out += to_string(inode);
+    out += '\t';
+    out += to_string(makedev(moved.stx_dev_major, moved.stx_dev_minor));
+    out += '\t';
+    out += to_string(moved.stx_ino);
+    out += '\n';
+}
+
+Journal::Journal(const string& homeBin):path(metaPath(homeBin, "journal." + to_string(getpid()))) {
+    ensureMetaDir(homeBin);
+    for (;;) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0 || flock(fd, LOCK_EX) != 0) {
+            throw toss_exception("cannot open journal " + path + ": " + strerror(errno));
+        }
+
+        // a replay may have taken the new, still unlocked log for a dead one and removed it
+        struct stat held, named;
+        if (fstat(fd, &held) == 0 && stat(path.c_str(), &named) == 0 && held.st_ino == named.st_ino) break;
+        close(fd);
+    }
+}
+
+Journal::~Journal() {
+    // only an empty log is removed; one still holding intents is left for the next replay
+    struct stat info;
+    if (fd >= 0 && pending.empty() && fstat(fd, &info) == 0 && info.st_size == 0) unlink(path.c_str());
+    if (fd >= 0) close(fd);
+}
+
+void Journal::intendToss(const string& bin, const CatalogEntry& entry, const struct statx& source) {
+    append(pending, '+', bin, entry, 0, source);
+}
+
+void Journal::intendRecover(const string& bin, const CatalogEntry& entry, ino_t replaced, const struct statx& stored) {
+    append(pending, '-', bin, entry, replaced, stored);
+}
+
+void Journal::sync() {
+    if (pending.empty()) return;
+    Phase phase("journal sync");
+    const char* p = pending.data();
+    size_t left = pending.size();
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw toss_exception("cannot write journal " + path + ": " + strerror(errno));
+        }
+        p += n;
+        left -= n;
+    }
+    if (fdatasync(fd) != 0) {
+        throw toss_exception("cannot sync journal " + path + ": " + strerror(errno));
+    }
+    pending.clear();
+}
+
+void Journal::clear() {
+    pending.clear();
+    if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0) {
+        throw toss_exception("cannot clear journal " + path + ": " + strerror(errno));
+    }
+}
+
+/** Replay **/
+
+namespace {
+
+struct Intent {
+    char op;
+    string bin;
+    CatalogEntry entry;
+    ino_t inode;
+    dev_t movedDevice = 0;      // the item being moved, before the move; 0 in logs of older tosses
+    ino_t movedInode = 0;
+};
+
+vector<Intent> readIntents(int fd) {
+    string data;
+    char buf[1 << 16];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        data.append(buf, n);
+    }
+
+    vector<Intent> intents;
+    const char* p = data.data();
+    const char* end = p + data.size();
+    while (p < end) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (eol == nullptr) break;   // torn record: its sync never finished, nothing moved for it
+
+        const char* fields[11];
+        int count = 0;
+        fields[count++] = p;
+        for (const char* c = p; c < eol && count < 11; ++c) {
+            if (*c == '\t') fields[count++] = c + 1;
+        }
+        if ((count == 8 || count == 10) && (*p == '+' || *p == '-')) {
+            Intent intent;
+            intent.op = *p;
+            intent.entry.type = *fields[1];
+            intent.entry.toss_time = strtol(fields[2], nullptr, 10);
+            intent.entry.size = strtoull(fields[3], nullptr, 10);
+            intent.entry.original = unescapeField(fields[4], fields[5] - 1);
+            intent.entry.stored = unescapeField(fields[5], fields[6] - 1);
+            intent.bin = unescapeField(fields[6], fields[7] - 1);
+            intent.inode = strtoull(fields[7], nullptr, 10);
+            if (count == 10) {
+                intent.movedDevice = strtoull(fields[8], nullptr, 10);
+                intent.movedInode = strtoull(fields[9], nullptr, 10);
+            }
+            intents.push_back(move(intent));
+        }
+        p = eol + 1;
+    }
+    return intents;
+}
+
+bool present(const string& path, struct stat& info) {
+    return lstat(path.c_str(), &info) == 0;
+}
+
+// remove what a dead process may have left half copied next to dest
+void dropPartialCopy(const string& dest, pid_t pid) {
+    error_code ec;
+    filesystem::remove_all(tempNameFor(dest, pid), ec);
+}
+
+// the item at path is the one the intent was about to move; unknown for logs without identities
+bool isMovedItem(const Intent& intent, const struct stat& info) {
+    return intent.movedInode != 0 && info.st_dev == intent.movedDevice && info.st_ino == intent.movedInode;
+}
+
+void replayToss(const Intent& intent, Catalog& catalog, pid_t pid, ReplayResult& result) {
+    const CatalogEntry& entry = intent.entry;
+    string stored = intent.bin + entry.stored;
+    struct stat source, info;
+    bool sourceLeft = present(entry.original, source);
+    bool storedThere = present(stored, info);
+    if (!storedThere) {
+        dropPartialCopy(stored, pid);
+        ++result.back;
+        return;
+    }
+
+    // the original path still holds what was tossed (or, in an older log, may hold it)
+    bool tossedLeft = sourceLeft && (intent.movedInode == 0 || isMovedItem(intent, source));
+    if (tossedLeft && startsWith(entry.stored, string("/") + META_DIR + "/objects/")) {
+        // the object may have been there before the toss: the file was never moved
+        dropPartialCopy(stored, pid);
+        ++result.back;
+        return;
+    }
+
+    // a fresh tree that landed whole: only the source removal of a cross-device move is missing,
+    // finished only while the source is still the very directory that was copied
+    if (tossedLeft && isMovedItem(intent, source)) {
+        error_code ec;
+        filesystem::remove_all(entry.original, ec);
+    }
+
+    // anything else at the original path stays, the stored copy is kept as a late toss
+    if (!catalog.contains(entry)) catalog.recordToss(entry, false, true);
+    ++result.forward;
+}
+
+void replayRecover(const Intent& intent, Catalog& catalog, pid_t pid, ReplayResult& result) {
+    const CatalogEntry& entry = intent.entry;
+    string stored = intent.bin + entry.stored;
+    struct stat info;
+
+    // landed only when the stored item itself was renamed into place, or is gone from the bin;
+    // a copy next to a stored item that is still there may be partial or the user's own file
+    bool storedLeft = present(stored, info);
+    bool renamed = present(entry.original, info) && isMovedItem(intent, info);
+    if (storedLeft && !renamed) {
+        dropPartialCopy(entry.original, pid);
+        ++result.back;
+        return;
+    }
+    if (catalog.contains(entry)) catalog.recordRecover(entry);
+    ++result.forward;
+}
+
+}
+
+ReplayResult replayJournals(BinRegistry& bins) {
+    ReplayResult result;
+    string dir = metaPath(bins.home(), "");
+    DIR* listing = opendir(dir.c_str());
+    if (listing == nullptr) return result;
+
+    vector<string> names;
+    while (struct dirent* entry = readdir(listing)) {
+        if (startsWith(entry->d_name, "journal.")) names.push_back(entry->d_name);
+    }
+    closedir(listing);
+
+    for (const auto& name: names) {
+        string path = dir + name;
+        int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0) continue;
+
+        // still held: that toss is alive and in the middle of its batch
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            close(fd);
+            continue;
+        }
+        pid_t pid = strtol(name.c_str() + strlen("journal."), nullptr, 10);
+        vector<Intent> intents = readIntents(fd);
+
+        // the same locks the dead toss held, against live tosses touching the same objects
+        map<string, vector<string>> scope;
+        for (const auto& intent: intents) scope[intent.bin].push_back(intent.entry.stored);
+        for (const auto& bin: scope) {
+            Catalog& catalog = bins.catalogFor(bin.first);
+            catalog.lockShards(bin.second);
+            catalog.refresh(bin.second);
+        }
+
+        for (const auto& intent: intents) {
+            Catalog& catalog = bins.catalogFor(intent.bin);
+            if (intent.op == '+') replayToss(intent, catalog, pid, result);
+            else replayRecover(intent, catalog, pid, result);
+        }
+
+        // the log goes only once what it settled is durable
+        bins.flush(true);
+        bins.unlockShards();
+        unlink(path.c_str());
+        close(fd);
+    }
+    return result;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "catalog.hpp"
+#include "bins.hpp"
+
+/**
+ * Write-ahead intent log for tosses and recovers, ~/.recyclebin/.toss/journal.<pid>
+ * - before a batch moves anything, every move it is about to make is appended and the log is
+ *   fsynced once (group commit), so a batch costs one fsync however many files it holds
+ * - once the batch's catalog records are synced the log is emptied again
+ * - the owner holds an flock on its log; a log nobody holds belongs to a toss that died
+ *
+ * Record format, one per line, tab separated with escaped paths:
+ *   <+|-> <f|d> <toss time> <size> <original> <stored> <bin> <inode> <device> <moved inode>
+ * i.e. the catalog record the move will produce, the bin it belongs to, for a recover the inode
+ * at the original path beforehand (0 if there was nothing), and the device and inode of the item
+ * being moved (the source of a toss, the stored item of a recover), to tell it from anything a
+ * user put in its place since. Logs of older tosses lack the last two fields.
+ */
+class Journal {
+private:
+    std::string path;
+    int fd = -1;
+    std::string pending;
+
+public:
+    Journal(const std::string& homeBin);
+    ~Journal();
+
+    // log a move that is about to happen, written out by sync()
+    void intendToss(const std::string& bin, const CatalogEntry& entry, const struct statx& source);
+    void intendRecover(const std::string& bin, const CatalogEntry& entry, ino_t replaced, const struct statx& stored);
+
+    // write and fsync everything logged since the last sync, before the moves start
+    void sync();
+
+    // the moves are done and their catalog records synced, forget them
+    void clear();
+};
+
+struct ReplayResult {
+    size_t forward = 0;     // moves found done (or finished) and recorded in the catalog
+    size_t back = 0;        // moves that never happened, their partial copies removed
+};
+
+/**
+ * Settle the logs of tosses that died mid batch, before anything reads the catalogs.
+ * A toss is done once the stored item exists and the original path no longer holds the item
+ * tossed; whatever a user has put there since is left alone. A cross-device move of a tree that
+ * copied everything but did not get to remove its source is finished only while the source is
+ * still that directory. A recover is done once the stored item is gone from the bin or was
+ * renamed into place; a copy next to a stored item still there keeps the item and its entry.
+ * Anything else is rolled back by removing the half written copy. Replaying is idempotent, a replay interrupted in turn is simply replayed again.
+ * A directory recovered by merging into an existing one is left as it is; recovering it again
+ * picks up where the merge stopped.
+ */
+ReplayResult replayJournals(BinRegistry& bins);
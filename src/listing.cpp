@@ -0,0 +1,76 @@
+#include "listing.hpp"
+
+#include <algorithm>
+using namespace std;
+
+Listing::Listing(Order order, size_t limit):order(order), limit(limit){}
+
+// a total order, so that pages cut with different limits and offsets line up
+bool Listing::before(uint32_t x, uint32_t y) const {
+    if (order == BySize && sizes[x] != sizes[y]) return sizes[x] > sizes[y];
+    int byPath = path(x).compare(path(y));
+    if (byPath != 0) return byPath < 0;
+    return times[x] > times[y];
+}
+
+void Listing::add(const CatalogEntry& entry) {
+    if (limit == 0) return;
+
+    // the new item goes in a slot of its own at the end, the scratch slot once the heap is full
+    uint32_t slot = times.size();
+    times.push_back(entry.toss_time);
+    sizes.push_back(entry.size);
+    starts.push_back(arena.size());
+    arena += entry.original;
+    if (entry.type == 'd') arena += '/';
+    lengths.push_back(arena.size() - starts.back());
+
+    if (heap.size() < limit) {
+        heap.push_back(slot);
+        if (limit != SIZE_MAX) push_heap(heap.begin(), heap.end(), [&](uint32_t x, uint32_t y) {return before(x, y);});
+        return;
+    }
+
+    uint32_t worst = heap.front();
+    if (before(slot, worst)) {
+        // displace the worst kept item: its slot takes the new one, its path becomes dead
+        auto cmp = [&](uint32_t x, uint32_t y) {return before(x, y);};
+        pop_heap(heap.begin(), heap.end(), cmp);
+        dead += lengths[worst];
+        times[worst] = times[slot];
+        sizes[worst] = sizes[slot];
+        starts[worst] = starts[slot];
+        lengths[worst] = lengths[slot];
+        push_heap(heap.begin(), heap.end(), cmp);
+    } else {
+        arena.resize(starts[slot]);
+    }
+    times.pop_back();
+    sizes.pop_back();
+    starts.pop_back();
+    lengths.pop_back();
+
+    if (dead > arena.size() / 2 && arena.size() > (1 << 20)) compact();
+}
+
+void Listing::compact() {
+    string packed;
+    packed.reserve(arena.size() - dead);
+    for (uint32_t i = 0; i < starts.size(); ++i) {
+        uint64_t start = packed.size();
+        packed.append(arena, starts[i], lengths[i]);
+        starts[i] = start;
+    }
+    arena.swap(packed);
+    dead = 0;
+}
+
+const vector<uint32_t>& Listing::ordered() {
+    if (!sorted) {
+        auto cmp = [&](uint32_t x, uint32_t y) {return before(x, y);};
+        if (limit != SIZE_MAX) sort_heap(heap.begin(), heap.end(), cmp);
+        else sort(heap.begin(), heap.end(), cmp);
+        sorted = true;
+    }
+    return heap;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+#include "catalog.hpp"
+
+/**
+ * Items of a listing kept as a structure of arrays rather than one object per item
+ * - toss times and sizes sit in packed arrays, paths are copied end to end into one arena
+ *   and referred to by offset and length, so adding an item allocates nothing of its own
+ * - ordering sorts a permutation of 4 byte indices, comparing the packed keys in place
+ * - with a limit only the first limit items of the order are kept, in a heap of indices;
+ *   an item that does not make it is taken back off the end of the arena, one that displaces
+ *   another reuses its slot and the arena is compacted once most of it is dead
+ */
+class Listing {
+public:
+    enum Order { ByName, BySize };
+
+private:
+    Order order;
+    size_t limit;
+
+    std::vector<long> times;
+    std::vector<uintmax_t> sizes;
+    std::vector<uint64_t> starts;
+    std::vector<uint32_t> lengths;
+    std::string arena;
+    uint64_t dead = 0;              // arena bytes of displaced items
+
+    std::vector<uint32_t> heap;     // indices kept, the one to drop next on top
+    bool sorted = false;
+
+    bool before(uint32_t x, uint32_t y) const;
+    void compact();
+
+public:
+    Listing(Order order, size_t limit = SIZE_MAX);
+
+    void add(const CatalogEntry& entry);
+
+    // indices of the kept items in listing order
+    const std::vector<uint32_t>& ordered();
+
+    long time(uint32_t i) const { return times[i]; }
+    uintmax_t size(uint32_t i) const { return sizes[i]; }
+    std::string_view path(uint32_t i) const { return std::string_view(arena.data() + starts[i], lengths[i]); }
+};
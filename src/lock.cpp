@@ -0,0 +1,107 @@
+#include "lock.hpp"
+#include "toss.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+static constexpr unsigned CATALOG_BYTE = 0;
+static constexpr unsigned USAGE_BYTE = 1;
+static constexpr unsigned FIRST_SHARD = 2;
+
+BinLocks::BinLocks(const string& recycledir):recycledir(recycledir), path(metaPath(recycledir, "lock")){}
+
+BinLocks::~BinLocks() {
+    if (fd >= 0) close(fd);
+}
+
+void BinLocks::open() {
+    if (fd >= 0) return;
+    ensureMetaDir(recycledir);
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) throw toss_exception("cannot open lock " + path + ": " + strerror(errno));
+}
+
+void BinLocks::set(unsigned offset, short type) {
+    open();
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = offset;
+    lock.l_len = 1;
+    while (fcntl(fd, F_OFD_SETLKW, &lock) != 0) {
+        if (errno == EINTR) continue;
+        throw toss_exception("cannot lock " + path + ": " + strerror(errno));
+    }
+}
+
+BinLocks::Guard::~Guard() {
+    if (owner == nullptr) return;
+    try {
+        if (offset == CATALOG_BYTE) {
+            // back to what was held before this guard
+            if (owner->catalogHeld != previous) {
+                owner->set(CATALOG_BYTE, previous == 0 ? F_UNLCK : previous == 1 ? F_RDLCK : F_WRLCK);
+                owner->catalogHeld = previous;
+            }
+        } else {
+            owner->set(offset, F_UNLCK);
+        }
+    } catch (const toss_exception&) {}
+}
+
+BinLocks::Guard BinLocks::catalogShared() {
+    int previous = catalogHeld;
+    if (catalogHeld == 0) {
+        set(CATALOG_BYTE, F_RDLCK);
+        catalogHeld = 1;
+    }
+    return Guard(this, CATALOG_BYTE, previous);
+}
+
+BinLocks::Guard BinLocks::catalogExclusive() {
+    int previous = catalogHeld;
+    if (catalogHeld != 2) {
+        // a shared lock is given up first rather than upgraded, two upgraders would deadlock
+        if (catalogHeld == 1) set(CATALOG_BYTE, F_UNLCK);
+        set(CATALOG_BYTE, F_WRLCK);
+        catalogHeld = 2;
+    }
+    return Guard(this, CATALOG_BYTE, previous);
+}
+
+BinLocks::Guard BinLocks::usage() {
+    set(USAGE_BYTE, F_WRLCK);
+    return Guard(this, USAGE_BYTE, 0);
+}
+
+void BinLocks::lockShards(const vector<string>& stored) {
+    vector<unsigned> wanted;
+    wanted.reserve(stored.size());
+    for (const auto& item: stored) wanted.push_back(hash<string>()(item) % SHARDS);
+    sort(wanted.begin(), wanted.end());
+    wanted.erase(unique(wanted.begin(), wanted.end()), wanted.end());
+
+    for (unsigned shard: wanted) {
+        if (binary_search(shardsHeld.begin(), shardsHeld.end(), shard)) continue;
+        set(FIRST_SHARD + shard, F_WRLCK);
+        shardsHeld.insert(upper_bound(shardsHeld.begin(), shardsHeld.end(), shard), shard);
+    }
+}
+
+void BinLocks::unlockShards() {
+    if (shardsHeld.empty()) return;
+    // every shard lives in one range, so a single unlock covers them all
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_UNLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = FIRST_SHARD;
+    lock.l_len = SHARDS;
+    fcntl(fd, F_OFD_SETLK, &lock);
+    shardsHeld.clear();
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * Inter-process locks of one recycle bin, byte-range locks on <recycledir>/.toss/lock.
+ * They are OFD locks (F_OFD_SETLKW): owned by this open file rather than the process, so they
+ * are not dropped when some other descriptor of the file is closed, and the kernel releases
+ * them when a toss dies.
+ *   byte 0       the catalog: shared by appenders, exclusive while it is rewritten
+ *   byte 1       the usage file's read-modify-write
+ *   byte 2 + n   shard n of the stored items, held from a decision about an object (is it
+ *                still referenced, may it be replaced) until the records of that batch are
+ *                written, so tossers of different objects never wait on each other
+ * Readers take no locks: the catalog only grows by whole appended records or is replaced
+ * by rename, so a listing never blocks a toss.
+ */
+class BinLocks {
+private:
+    std::string recycledir;
+    std::string path;
+    int fd = -1;
+    int catalogHeld = 0;                // 0 none, 1 shared, 2 exclusive
+    std::vector<unsigned> shardsHeld;
+
+    void open();
+    void set(unsigned offset, short type);
+
+public:
+    static constexpr unsigned SHARDS = 1024;
+
+    // releases its lock when it goes out of scope
+    class Guard {
+    private:
+        BinLocks* owner;
+        unsigned offset;
+        int previous;
+    public:
+        Guard(BinLocks* owner, unsigned offset, int previous):owner(owner), offset(offset), previous(previous){}
+        Guard(Guard&& other):owner(other.owner), offset(other.offset), previous(other.previous) { other.owner = nullptr; }
+        Guard(const Guard&) = delete;
+        ~Guard();
+    };
+
+    BinLocks(const std::string& recycledir);
+    ~BinLocks();
+
+    // taking the catalog lock while already holding it (e.g. shared inside exclusive) keeps the stronger one
+    Guard catalogShared();
+    Guard catalogExclusive();
+    Guard usage();
+
+    // lock the shards of these stored paths, in ascending order so lockers never deadlock;
+    // held until unlockShards(). Take everything a batch needs in one call: shards added
+    // while others are held would break the ordering
+    void lockShards(const std::vector<std::string>& stored);
+    void unlockShards();
+};
@@ -1,110 +1,100 @@
 #include <iostream>
 #include <iomanip>
 #include <filesystem>
-#include <chrono>
 #include <ctime>
 #include <cstdint>
-#include <cmath>
-#include <regex>
+#include <functional>
+#include <set>
+#include <vector>
+#include <utility>
 #include <string.h>
-#include <sys/stat.h>
 #include <unistd.h>
-#include <pwd.h>
 
 // custom libraries
 #include <argparse/argparse.hpp>
+#include "toss.hpp"
+#include "engine.hpp"
+#include "scanner.hpp"
+#include "config.hpp"
+#include "input.hpp"
+#include "output.hpp"
+#include "select.hpp"
+#include "daemon.hpp"
+#include "watch.hpp"
+#include "stats.hpp"
 using namespace std;
 
-class toss_exception {
-private:
-    string msg;
-public:
-    toss_exception(string msg):msg(msg){}
-    const char* what() const { return msg.c_str(); }
-};
-
-struct TossFile {
-    string path;
-    long change_time;
-    uintmax_t size;
-    TossFile(string p, long c, uintmax_t s):path(p), change_time(c), size(s){}
-};
+// paths read from stdin are resolved, moved and recorded this many at a time
+constexpr size_t STDIN_BATCH = 4096;
 
 struct HumanReadable {
     std::uintmax_t size {};
  
     template <typename Os> friend Os& operator<< (Os& os, HumanReadable hr)
     {
-        int i{};
-        double mantissa = hr.size;
-        for (; mantissa >= 1024.; ++i) {
-            mantissa /= 1024.;
-        }
-        mantissa = std::ceil(mantissa * 10.) / 10.;
-        os << mantissa << "BKMGTPE"[i];
-        return i == 0 ? os : os << "B (" << hr.size << ')';
+        return os << humanSize(hr.size);
     }
 };
 
-int isDirectory(const char* path) {
-    struct stat statbuf;
-    if (stat(path, &statbuf) != 0) return 0;
-    return S_ISDIR(statbuf.st_mode);
-}
-
-long getChangeTimeLong(const char* path) {
-    struct stat fileInfo;
-    if (stat(path, &fileInfo) != 0) {
-        cerr << "Error: " << strerror(errno) << endl;
-        exit(1);
-    }
-    return fileInfo.st_ctime;
+bool confirmed() {
+    string input;
+    cin >> input; 
+    return input == "y" || input == "Y" || input == "yes" || input == "Yes" || input == "YES";
 }
 
-string getChangeTimeString(const char* path) {
-    struct stat fileInfo;
-    if (stat(path, &fileInfo) != 0) {
-        cerr << "Error: " << strerror(errno) << endl;
-        exit(1);
+bool confirmReplace(const vector<string>& dests) {
+    if (dests.size() == 1) {
+        cout << "There currently exists a file you want to replace: " << dests[0] << endl;
+        cout << "Are you sure you want to replace this? (y/n)" << endl;
+    } else {
+        cout << "There currently exist " << dests.size() << " files you want to replace:" << endl;
+        for (const auto& dest: dests) cout << "  " << dest << endl;
+        cout << "Are you sure you want to replace these? (y/n)" << endl;
     }
-
-    return ctime(&fileInfo.st_ctime);
-}
-
-string getChangeTimeString(const string& path) {
-    return getChangeTimeString(path.c_str());
+    return confirmed();
 }
 
-long getChangeTimeLong(const string& path) {
-    return getChangeTimeLong(path.c_str());
+string plural(uintmax_t count, const string& what) {
+    return to_string(count) + " " + what + (count == 1 ? "" : "s");
 }
 
-bool isRelativePath(const string& str) {
-    return str.rfind("/", 0) != 0 && str.rfind("~", 0) != 0 && str.rfind("\\", 0) != 0;
-}
-
-bool startsWith(const string& str, const string& prefix) {
-    return str.substr(0, prefix.size()) == prefix;
-}
-
-int main(int argc, char *argv[]) {
-
-    // set home directory to environment or based on user's home directory
-    string homedir, recycledir;
-    if ((homedir = getenv("HOME")) == "") {
-        homedir = getpwuid(getuid())->pw_dir;
-        // recycledir = getpwuid(getuid())->pw_dir;
+// what a batch would do, item by item, then the directories it creates and the files it replaces
+void printPlan(const Plan& plan, const PlanReport& report) {
+    cout << (plan.recover ? "Recover " : "Toss ") << plural(report.files, "file") << ", " << HumanReadable{report.bytes};
+    if (report.copiedBytes > 0) cout << " (" << HumanReadable{report.copiedBytes} << " copied across filesystems)";
+    cout << endl << endl;
+
+    cout << left << setw(50) << "Filename" << left << setw(12) << "Size" << "Notes" << endl << endl;
+    auto print = [&](const TossMove& item) {
+        bool dir = item.entry.type == 'd';
+        vector<string> notes;
+        if (dir) notes.push_back("directory of " + plural(item.files, "file"));
+        if (item.statResult != 0) notes.push_back("not found");
+        if (item.replaced != 0) notes.push_back(dir ? "merged into the directory there" : "replaces the file there");
+        if (item.copied) notes.push_back("copied across filesystems");
+        string joined;
+        for (const auto& note: notes) joined += (joined.empty() ? "" : ", ") + note;
+
+        string path = plan.recover ? item.dest : item.src;
+        uintmax_t size = plan.recover || dir ? item.entry.size : item.info.stx_size;
+        cout << left << setw(50) << (dir ? path + "/" : path) << left << setw(12) << humanSize(item.statResult == 0 ? size : 0) << joined << endl;
+    };
+    for (const auto& dir: plan.dirs) print(dir);
+    for (const auto& file: plan.files) print(file);
+
+    if (!report.created.empty()) {
+        cout << endl << "Directories to create:" << endl;
+        for (const auto& dir: report.created) cout << "  " << dir << endl;
     }
-    recycledir = homedir + "/.recyclebin";
-
-    // build home directory
-    int status = mkdir(recycledir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
-
-    // EEXIST is the error that throws if already exists, otherwise some other error    
-    if (status && errno != EEXIST) {
-        cerr << "Cannot create recyclebin for unknown reason: " << strerror(errno) << endl;
-        throw std::runtime_error(strerror(errno));
+    if (!report.replaced.empty()) {
+        cout << endl << "Files to replace:" << endl;
+        for (const auto& file: report.replaced) cout << "  " << file << endl;
     }
+}
+
+// one toss command, run by bin/toss or by tossd in a process forked for it
+static int runToss(int argc, char *argv[]) {
+    int64_t started = statsNow();
 
     /**
      * nothing = files
@@ -135,12 +125,43 @@ int main(int argc, char *argv[]) {
         .default_value(false)
         .implicit_value(true);
 
-    /*
-    program.add_argument("-g", "--regex", "--reg")
-        .help("enable regex matching for files to toss/recover")
+    program.add_argument("--limit")
+        .help("list at most this many items")
+        .scan<'i', int>();
+
+    program.add_argument("--offset")
+        .help("skip this many items before listing")
+        .default_value(0)
+        .scan<'i', int>();
+
+    program.add_argument("--format")
+        .help("list as a table, or as tsv or json for scripts")
+        .default_value(string("table"));
+
+    program.add_argument("--du")
+        .help("show how much is tossed from below the given directories (default: the current one)")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--rebuild-catalog")
+        .help("rebuild the recycle bin catalog from the files on disk")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--watch")
+        .help("keep the catalogs up to date with changes made to the recycle bins by hand, until interrupted")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("-g", "--glob")
+        .help("take the given files as glob patterns matched against the recycle bin, to list or recover")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--regex", "--reg")
+        .help("take the given files as regular expressions matched against the recycle bin, to list or recover")
         .default_value(false)
         .implicit_value(true);
-    */
 
     program.add_argument("-r", "--recursive")
         .help("recursively toss directories into the recycle bin")
@@ -152,6 +173,61 @@ int main(int argc, char *argv[]) {
         .default_value(false)
         .implicit_value(true);
 
+    program.add_argument("--revision")
+        .help("recover this version of a file instead of the newest (see --history)")
+        .scan<'i', int>();
+
+    program.add_argument("--history")
+        .help("list the versions of the given files kept in the recycle bin")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--purge")
+        .help("permanently delete items tossed more than --older-than days ago")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--older-than")
+        .help("age in days of the items --purge deletes")
+        .default_value(30)
+        .scan<'i', int>();
+
+    program.add_argument("--quota")
+        .help("keep each recycle bin under this size (e.g. 10G) by deleting the oldest items, 0 for no limit");
+
+    program.add_argument("-j", "--threads")
+        .help("threads used to scan directory trees (default: one per CPU)")
+        .default_value(0)
+        .scan<'i', int>();
+
+    program.add_argument("--stats")
+        .help("print where the time went, phase by phase, on stderr")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--trace")
+        .help("write the phases as a Chrome trace (chrome://tracing) to this file");
+
+    program.add_argument("--dry-run")
+        .help("show what tossing or recovering the files would do, without doing it")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--plan")
+        .help("show what tossing or recovering the files would do, and ask before doing it")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--stdin0")
+        .help("read the files to toss or recover from stdin, separated by NUL (find -print0)")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--stdin")
+        .help("read the files to toss or recover from stdin, one per line")
+        .default_value(false)
+        .implicit_value(true);
+
     program.add_argument("files")
         .help("files or directories to toss into recycle bin")
         .remaining();
@@ -164,192 +240,307 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
-    /** List Recycle Bin **/
-    vector<TossFile> files; 
-    if (program["--list"]  == true || program["--list-name"]  == true || program["--list-size"] == true) { 
-
-        // list header
-        cout << left << setw(30) << "Date Tossed" << left << setw(50) << "Filename" << right << "Size" << endl << endl;
-        // cout << string(90, '=') << endl;
-
-
-        // load all files in recycle bin
-        for (const auto& entry: filesystem::recursive_directory_iterator(recycledir.c_str())) {
-            if (entry.is_regular_file()) {
-                string path = entry.path().string();
-                long change_time = getChangeTimeLong(entry.path().string());
-                uintmax_t size = entry.file_size();
-                files.push_back({path, change_time, size});    
-            } 
+    setScanThreads(max(program.get<int>("--threads"), 0));
+    if (program["--stats"] == true || program.present("--trace")) {
+        enableStats(program["--stats"] == true, program.present("--trace").value_or(""), started);
+        recordPhase("parse arguments", started);
+    }
+
+    // set home directory to environment or based on user's home directory
+    unique_ptr<Engine> opened;
+    try {
+        opened = make_unique<Engine>(homeRecycleBin());
+    } catch (const toss_exception& err) {
+        cerr << "toss error: " << err.what() << endl;
+        exit(1);
+    }
+    Engine& engine = *opened;
+    const ReplayResult& replayed = engine.replayed();
+    if (replayed.forward + replayed.back > 0) {
+        cerr << "toss: finished an interrupted operation (" << replayed.forward << " moves completed, " << replayed.back << " rolled back)" << endl;
+    }
+
+    /** Rebuild Catalog **/
+    if (program["--rebuild-catalog"] == true) {
+        try {
+            size_t count = engine.rebuildCatalogs();
+            cout << "Rebuilt catalog with " << count << " files." << endl;
+        } catch (const toss_exception& err) {
+            cerr << "toss error: " << err.what() << endl;
+            exit(1);
+        } catch (const filesystem::filesystem_error& err) {
+            cerr << "filesystem error: " << err.what() << endl;
+            exit(1);
         }
+        if (program["--list"] == false && program["--list-name"] == false && program["--list-size"] == false) {
+            return 0;
+        }
+    }
 
-        // sort by recent
-        if (program["--list"] == true) {      
-            sort(files.begin(), files.end(), [](const auto &x, const auto &y) {return x.change_time > y.change_time;}); 
+    /** Watch Recycle Bins **/
+    if (program["--watch"] == true) {
+        try {
+            watchBins(engine.bins());
+        } catch (const toss_exception& err) {
+            cerr << "toss error: " << err.what() << endl;
+            exit(1);
+        } catch (const filesystem::filesystem_error& err) {
+            cerr << "filesystem error: " << err.what() << endl;
+            exit(1);
         }
+        return 0;
+    }
 
-        // sort by name
-        else if (program["--list-name"] == true) {
-            sort(files.begin(), files.end(), [](const auto &x, const auto &y) {return x.path < y.path;});
+    /** Set Quota **/
+    if (auto quota = program.present("--quota")) {
+        uintmax_t bytes = 0;
+        try {
+            bytes = parseSize(*quota);
+            engine.setQuota(bytes);
+        } catch (const toss_exception& err) {
+            cerr << "toss error: " << err.what() << endl;
+            exit(1);
         }
+        if (bytes == 0) cout << "Recycle bin quota removed." << endl;
+        else cout << "Recycle bin quota set to " << HumanReadable{bytes} << "." << endl;
+        return 0;
+    }
 
-        // sort by size
-        else if (program["--list-size"] == true) {
-            sort(files.begin(), files.end(), [](const auto &x, const auto &y) {return x.size > y.size;});
+    /** Purge Expired Items **/
+    if (program["--purge"] == true) {
+        long cutoff = time(nullptr) - 86400L * program.get<int>("--older-than");
+        PurgeResult purged;
+        try {
+            purged = engine.purge(cutoff);
+        } catch (const toss_exception& err) {
+            cerr << "toss error: " << err.what() << endl;
+            exit(1);
+        } catch (const filesystem::filesystem_error& err) {
+            cerr << "filesystem error: " << err.what() << endl;
+            exit(1);
         }
-        
-        /*
-        else if (program["--list-expiring"] == true) {
-            sort(files.begin(), files.end(), [](const auto &x, const auto &y) {return x.change_time < y.change_time;});
+        cout << "Purged " << purged.files << " files, freed " << HumanReadable{purged.bytes} << "." << endl;
+        return 0;
+    }
 
+    /** Select by Pattern **/
+    bool listing = program["--list"]  == true || program["--list-name"]  == true || program["--list-size"] == true;
+    vector<Pattern> patterns;
+    if (program["--glob"] == true || program["--regex"] == true) {
+        if (program["--glob"] == true && program["--regex"] == true) {
+            cerr << "toss error: --glob and --regex cannot be combined" << endl;
+            exit(1);
         }
-        */
-
-        // list all files in recycle bin
-        for (const auto& file: files) {
-            string path = file.path;
-            string change_time = ctime(&file.change_time);
-            uintmax_t size = file.size;
-            path.erase(0, recycledir.size()); 
-            change_time = change_time.substr(0, change_time.size() - 1);  
-            cout << left << setw(30) << change_time << left << setw(50) << path << right << HumanReadable{size} << endl;
+        if (!listing && program["--recover"] == false) {
+            cerr << "toss error: patterns select items in the recycle bin, use them to list or recover" << endl;
+            exit(1);
+        }
+        if (program["--stdin0"] == true || program["--stdin"] == true) {
+            cerr << "toss error: patterns are given as arguments, not on stdin" << endl;
+            exit(1);
+        }
+        auto given = program.present<vector<string>>("files");
+        if (!given) {
+            cerr << "No patterns provided" << endl;
+            exit(1);
+        }
+        const string cwd = filesystem::current_path().string();
+        try {
+            for (const auto& text: *given) patterns.emplace_back(program["--glob"] == true ? Pattern::Glob : Pattern::Regex, text, cwd);
+        } catch (const toss_exception& err) {
+            cerr << "toss error: " << err.what() << endl;
+            exit(1);
         }
-
-        exit(1);           
     }
 
-    // catch file arguments 
-    vector<string> inputs;
-    try {
-        inputs = program.get<vector<string>>("files");
-    } catch (std::logic_error& err) {
-        cerr << "No files provided" << endl;
-        cerr << program << endl;
-        exit(1);
+    /** List Recycle Bin **/
+    if (listing) { 
+        size_t offset = max(program.get<int>("--offset"), 0);
+        size_t limit = SIZE_MAX;
+        if (auto given = program.present<int>("--limit")) limit = max(*given, 0);
+        Engine::ListOrder order = Engine::Recent;
+        if (program["--list"] == false) order = program["--list-name"] == true ? Engine::ByName : Engine::BySize;
+
+        try {
+            ListWriter out(STDOUT_FILENO, parseFormat(program.get<string>("--format")));
+            out.header();
+            engine.list(order, offset, limit, patterns, [&](long time, string_view path, uintmax_t size) {
+                out.row(time, path, size);
+            });
+            out.finish();
+        } catch (const toss_exception& err) {
+            cerr << "toss error: " << err.what() << endl;
+            exit(1);
+        } catch (const filesystem::filesystem_error& err) {
+            cerr << "filesystem error: " << err.what() << endl;
+            exit(1);
+        }
+
+        return 0;
     }
 
-    /* prepare source and destination file pairs
-        - if recovering, src moves from recycle bin to actual file
-        - if tossing, src moves from actual file to recycle bin 
-    */
-    
-    vector<pair<string, string>> src_dest_files;
-    vector<string> dirToDelete;
-    try {
-        for (unsigned int i = 0; i < inputs.size(); ++i) {
-            string src = "";
-            string dest = "";
-
-            // do not include recycledir path in file input
-            if (startsWith(inputs[i], recycledir)) {
-                throw toss_exception("do not include recycle directory: \"" + recycledir + "\" in the filename");
-            } 
-
-            /** If recovering, source = ~/.recyclebin, dest = actual path **/
-            if (program["--recover"] == true) {
-
-                // modify for relative path
-                if (isRelativePath(inputs[i])) {
-                    dest = filesystem::current_path().string() + "/" + inputs[i];
-                } else {
-                    dest = inputs[i];
-                }
-                src = recycledir + dest;
-            }
+    /** Tossed Usage by Directory **/
+    if (program["--du"] == true) {
+        const string cwd = filesystem::current_path().string();
+        vector<string> dirs{cwd};
+        if (auto given = program.present<vector<string>>("files")) dirs = *given;
 
-            else if (program["--recover"] == false) {
+        auto print = [](const string& dir, const DirTotals& totals) {
+            string oldest = ctime(&totals.oldest);
+            oldest = oldest.substr(0, oldest.size() - 1);
+            cout << left << setw(30) << oldest << left << setw(50) << dir << left << setw(10) << totals.items << right << HumanReadable{totals.bytes} << endl;
+        };
 
-                // modify for relative path
-                if (isRelativePath(inputs[i])) {
-                    src = filesystem::current_path().string() + "/" + inputs[i];
-                } else {
-                    src = inputs[i];
+        try {
+            for (const auto& input: dirs) {
+                string dir = absolutePath(cwd, input);
+                DirTotals total;
+                vector<pair<string, DirTotals>> children;
+                if (!engine.du(dir, total, children)) {
+                    cout << "Nothing tossed from " << dir << endl;
+                    continue;
                 }
-                dest = recycledir + src;
-            }
 
-            /**
-             * Push back final source and destination files for tossing or recovery
-             * 1. push all non-directory files 
-             * 2. throw error if pushing directory recursively without flag
-             * 3. push regular files recursively from directory
-             * 4. at the very end delete ALL initial directories recursively, passed as inputs -> dirToDelete
-             */ 
-            if (filesystem::is_directory(src) == false) {
-                src_dest_files.push_back({src, dest});
-            } else if (program["--recursive"] == false) {
-                throw toss_exception(src + " is a directory. Use --recursive flag to include directories");
-            } else if (program["--recursive"] == true) {
-                dirToDelete.push_back(src);
-                for (const auto& entry: filesystem::recursive_directory_iterator(src)) {
-
-                    // delete these directories after everything has been copied
-                    
-
-                    // if recovering recursively, pick recycledir as src, actual path as dest
-                    // might be able to remove!
-                    if (entry.is_regular_file() && startsWith(entry.path().string(), recycledir)) {
-                        string src_ = entry.path().string();
-                        string dest_ = entry.path().string().substr(recycledir.size());
-                        src_dest_files.push_back({src_, dest_});
-                    }
-
-                    // if tossing recursively, pick actual path as src, recycledir as src
-                    else if (entry.is_regular_file()) {
-                        string src_ = entry.path().string();
-                        string dest_ = recycledir + entry.path().string();
-                        src_dest_files.push_back({src_, dest_});
-                    }
-                }
+                // the directory, then its subdirectories largest first
+                cout << left << setw(30) << "Oldest Toss" << left << setw(50) << "Directory" << left << setw(10) << "Items" << right << "Size" << endl << endl;
+                print(dir == "/" ? dir : dir + "/", total);
+                for (const auto& child: children) print(child.first + "/", child.second);
             }
+        } catch (const toss_exception& err) {
+            cerr << "toss error: " << err.what() << endl;
+            exit(1);
         }
-    } catch (toss_exception& err) {
-        cerr << "toss error: " << err.what() << endl;
-        exit(1);
+        return 0;
     }
 
-    /*
-     * Handle remaining toss / recover operations
-     * 
-     */
-    for (auto& file: src_dest_files) {
-        filesystem::path src = file.first;
-        filesystem::path dest = file.second;
-        
+    // catch file arguments, or read them from stdin in batches
+    vector<string> inputs;
+    unique_ptr<PathReader> reader;
+    if (program["--stdin0"] == true || program["--stdin"] == true) {
+        // stdin carries the paths, so there is nobody to answer a replace prompt
+        if (program["--recover"] == true && program["--force"] == false) {
+            cerr << "toss error: recovering paths from stdin needs --force" << endl;
+            exit(1);
+        }
+        if (program["--plan"] == true) {
+            cerr << "toss error: --plan asks before running, so its paths cannot come from stdin (see --dry-run)" << endl;
+            exit(1);
+        }
+        reader = make_unique<PathReader>(STDIN_FILENO, program["--stdin0"] == true ? '\0' : '\n');
+    } else {
         try {
+            inputs = program.get<vector<string>>("files");
+        } catch (std::logic_error& err) {
+            cerr << "No files provided" << endl;
+            cerr << program << endl;
+            exit(1);
+        }
+    }
 
-            // throw error if item doesn't exist in recycle bin to recover
-            if (filesystem::exists(src) == false && program["--recover"] == true) {
-                throw toss_exception("failed to recover - file not found in recycle bin: " + src.string());
-            }
+    bool argumentsTaken = false;
+    auto nextBatch = [&](vector<string>& batch) {
+        if (reader == nullptr) {
+            if (argumentsTaken) return false;
+            argumentsTaken = true;
+            return true;
+        }
+        try {
+            Phase phase("read paths");
+            return reader->next(batch, STDIN_BATCH);
+        } catch (const toss_exception& err) {
+            cerr << "toss error: " << err.what() << endl;
+            engine.bins().flush();
+            exit(1);
+        }
+    };
+
+    // resolved once, not per path
+    const string cwd = filesystem::current_path().string();
+
+    // every version of every path, only needed to recover or show history
+    if (program["--recover"] == true || program["--history"] == true) {
+        // only the paths asked about, unless they come from stdin
+        vector<string> prefixes;
+        for (const auto& pattern: patterns) prefixes.push_back(pattern.prefix());
+        if (patterns.empty() && reader == nullptr) {
+            for (const auto& input: inputs) prefixes.push_back(absolutePath(cwd, input));
+        }
+        try {
+            engine.loadHistory(prefixes);
+        } catch (const toss_exception& err) {
+            cerr << "toss error: " << err.what() << endl;
+            exit(1);
+        }
+    }
+
+    // the paths in the recycle bin that the patterns pick are what gets recovered
+    if (!patterns.empty()) {
+        inputs = engine.matching(patterns);
+        if (inputs.empty()) {
+            cerr << "toss error: nothing in the recycle bin matches" << endl;
+            exit(1);
+        }
+    }
 
-            // throw error if item doesn't exist in system to toss
-            else if (filesystem::exists(src) == false && program["--recover"] == false) {
-                throw toss_exception("failed to toss - file not found " + src.string());
+    /** Show Version History **/
+    if (program["--history"] == true) {
+        while (nextBatch(inputs)) for (auto& input: inputs) {
+            string path = absolutePath(cwd, input);
+
+            cout << path << endl;
+            vector<Version> versions = engine.versionsOf(path);
+            if (versions.empty()) cout << "  no versions in recycle bin" << endl;
+            for (size_t v = 0; v < versions.size(); ++v) {
+                string change_time = ctime(&versions[v].entry.toss_time);
+                change_time = change_time.substr(0, change_time.size() - 1);
+                cout << "  --revision " << left << setw(6) << v + 1 << setw(30) << change_time << right << HumanReadable{versions[v].entry.size} << (versions[v].entry.type == 'd' ? "  (directory)" : "") << endl;
             }
-            
-            // confirm recovery if file already exists at destination
-            else if (filesystem::exists(dest) && program["--recover"] == true && program["--force"] == false) {
-                cout << "There currently exists a file you want to replace: " << dest << endl;
-                cout << "Are you sure you want to replace this? (y/n)" << endl;
-                string input;
-                cin >> input; 
-                if (input == "y" || input == "Y" || input == "yes" || input == "Yes" || input == "YES") {
-                    filesystem::create_directories(dest.parent_path());
-                    filesystem::rename(src, dest);
-                } else {
-                    cout << "toss operation canceled" << endl;
-                    exit(1);
-                }
-            } 
+        }
+        return 0;
+    }
 
-            // otherwise continue if tossing or forced flag enabled or file does not exist at destination
-            else {
-                filesystem::create_directories(dest.parent_path());
-                filesystem::rename(src, dest);
+    PlanOptions options;
+    options.recover = program["--recover"] == true;
+    options.recursive = program["--recursive"] == true;
+    options.revision = program.present<int>("--revision").value_or(0);
+    options.time = time(nullptr);
+    options.cwd = cwd;
+    bool dryRun = program["--dry-run"] == true;
+    bool review = program["--plan"] == true;
+    options.hash = !dryRun;
+    bool ask = options.recover && program["--force"] == false;
+
+    /**
+     * Each batch is planned, then moved and committed; an error ends the run with what was moved kept
+     * - every replace the batch needs is agreed to before any of it moves
+     * - --dry-run prints the plan instead, --plan prints it and asks once to run it
+     */
+    uintmax_t count = 0;
+    while (nextBatch(inputs)) {
+        try {
+            Plan plan = engine.plan(inputs, options);
+            vector<string> replaced;
+            if (dryRun || review) {
+                PlanReport report = engine.describe(plan);
+                printPlan(plan, report);
+                if (dryRun) continue;
+                cout << endl << "Run this plan? (y/n)" << endl;
+                if (!confirmed()) throw toss_canceled();
+                replaced = report.replaced;
+            } else if (ask) {
+                replaced = engine.conflicts(plan);
+                if (!replaced.empty() && !confirmReplace(replaced)) throw toss_canceled();
             }
-            
-        } catch(const toss_exception& err) {
+
+            // only a file that turned up since the batch was planned is asked about while it runs
+            set<string> agreed(replaced.begin(), replaced.end());
+            ConfirmReplace confirm;
+            if (ask) confirm = [&](const string& dest) {return agreed.count(dest) > 0 || confirmReplace({dest});};
+            count += engine.execute(plan, confirm);
+        } catch (const toss_canceled&) {
+            cout << "toss operation canceled" << endl;
+            exit(1);
+        } catch (const toss_exception& err) {
             cerr << "toss error: " << err.what() << endl;
             exit(1);
         } catch (const filesystem::filesystem_error& err) {
@@ -357,12 +548,37 @@ int main(int argc, char *argv[]) {
             exit(1);
         }
     }
+    if (dryRun) return 0;
+
+    // make room under the quota, oldest items first, never the ones just tossed
+    if (!options.recover) {
+        PurgeResult evicted;
+        try {
+            evicted = engine.enforceQuota(options.time);
+        } catch (const toss_exception& err) {
+            cerr << "toss error: " << err.what() << endl;
+            exit(1);
+        }
+        if (evicted.files > 0) {
+            cout << "Deleted " << evicted.files << " old files (" << HumanReadable{evicted.bytes} << ") to stay under the recycle bin quota." << endl;
+        }
+    }
 
-    // delete all input source directories afterward
-    for (auto& delDir: dirToDelete) {
-        filesystem::remove_all(delDir);
+    if (!options.recover) cout << "Successfully tossed " << count << " files." << endl;
+    else cout << "Successfully tossed back " << count << " files." << endl;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    // bin/tossd: serve commands sent by tossc until stopped
+    if (invokedAs(argv[0], "tossd")) {
+        try {
+            return serveDaemon(runToss);
+        } catch (const toss_exception& err) {
+            cerr << "toss error: " << err.what() << endl;
+            return 1;
+        }
     }
 
-    if (program["--recover"] == false) cout << "Successfully tossed " << src_dest_files.size() << " files." << endl;
-    else if (program["--recover"] == true) cout << "Successfully tossed back " << src_dest_files.size() << " files." << endl;
+    return runToss(argc, argv);
 }
\ No newline at end of file
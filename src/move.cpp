@@ -0,0 +1,101 @@
+#include "move.hpp"
+#include "toss.hpp"
+#include "transfer.hpp"
+#include "scanner.hpp"
+#include "stats.hpp"
+
+#include <filesystem>
+#include <vector>
+#include <sys/stat.h>
+using namespace std;
+
+static void mergeTree(const filesystem::path& src, const filesystem::path& dest, bool replaceDirs, const ConfirmReplace& confirm) {
+    for (const auto& entry: filesystem::directory_iterator(src)) {
+        filesystem::path target = dest / entry.path().filename();
+        error_code ec;
+        filesystem::file_status targetStatus = filesystem::symlink_status(target, ec);
+
+        // nothing in the way, move the whole child in one go
+        if (!filesystem::exists(targetStatus)) {
+            movePath(entry.path().string(), target.string());
+            continue;
+        }
+
+        // both sides are directories, only descend here
+        bool srcIsDir = entry.is_directory() && !entry.is_symlink();
+        bool targetIsDir = filesystem::is_directory(targetStatus);
+        if (srcIsDir && targetIsDir) {
+            mergeTree(entry.path(), target, replaceDirs, confirm);
+            continue;
+        }
+
+        if (confirm && !confirm(target.string())) throw toss_canceled();
+
+        // rename cannot replace a directory with a file or the other way around
+        if (srcIsDir != targetIsDir) {
+            if (!replaceDirs) {
+                throw toss_exception("cannot replace " + target.string() + " with " + entry.path().string());
+            }
+            filesystem::remove_all(target);
+        }
+        movePath(entry.path().string(), target.string());
+    }
+    filesystem::remove(src);
+}
+
+bool moveTree(const string& src, const string& dest, bool replaceDirs, const ConfirmReplace& confirm) {
+    Phase phase("move tree");
+    error_code ec;
+    filesystem::file_status destStatus = filesystem::symlink_status(dest, ec);
+
+    if (!filesystem::exists(destStatus)) {
+        filesystem::create_directories(filesystem::path(dest).parent_path());
+        movePath(src, dest);
+        return false;
+    }
+
+    if (!filesystem::is_directory(destStatus)) {
+        if (!replaceDirs) {
+            throw toss_exception("cannot replace " + dest + " with directory " + src);
+        }
+        filesystem::remove(dest);
+        movePath(src, dest);
+        return false;
+    }
+
+    mergeTree(src, dest, replaceDirs, confirm);
+    return true;
+}
+
+void mergeConflicts(const string& src, const string& dest, vector<string>& conflicts) {
+    for (const auto& entry: filesystem::directory_iterator(src)) {
+        filesystem::path target = filesystem::path(dest) / entry.path().filename();
+        error_code ec;
+        filesystem::file_status targetStatus = filesystem::symlink_status(target, ec);
+        if (!filesystem::exists(targetStatus)) continue;
+
+        // the same walk as mergeTree, which only descends where both sides are directories
+        if (entry.is_directory() && !entry.is_symlink() && filesystem::is_directory(targetStatus)) {
+            mergeConflicts(entry.path().string(), target.string(), conflicts);
+        } else {
+            conflicts.push_back(target.string());
+        }
+    }
+}
+
+TreeSize treeSize(const string& path) {
+    vector<TreeSize> perWorker(scanThreads());
+    scanTree(path, [&](unsigned worker, const ScanEntry& entry) {
+        if (S_ISREG(entry.info.st_mode)) {
+            perWorker[worker].bytes += entry.info.st_size;
+            perWorker[worker].files += 1;
+        }
+    });
+
+    TreeSize total;
+    for (const auto& part: perWorker) {
+        total.bytes += part.bytes;
+        total.files += part.files;
+    }
+    return total;
+}
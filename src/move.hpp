@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+struct TreeSize {
+    uintmax_t bytes = 0;
+    uintmax_t files = 0;
+};
+
+// asked before a file in the way of a merge is replaced, false cancels it (throws toss_canceled)
+using ConfirmReplace = std::function<bool(const std::string& dest)>;
+
+/**
+ * Move a whole directory tree from src to dest.
+ * - dest missing: a single rename, no matter how many files are below src
+ * - dest already a directory: src is merged into it, renaming each child that is not in the way
+ *   and only descending into directories that exist on both sides
+ * Returns true if dest already existed and src was merged into it.
+ */
+bool moveTree(const std::string& src, const std::string& dest, bool replaceDirs, const ConfirmReplace& confirm);
+
+// what moveTree(src, dest) would ask to replace while merging src into the existing directory
+// dest: the paths below dest in the way of a file, or of a directory where dest has a file
+void mergeConflicts(const std::string& src, const std::string& dest, std::vector<std::string>& conflicts);
+
+// total size and number of regular files below path
+TreeSize treeSize(const std::string& path);
@@ -0,0 +1,328 @@
+#include "objects.hpp"
+#include "toss.hpp"
+#include "hash.hpp"
+#include "transfer.hpp"
+#include "stats.hpp"
+
+#include <filesystem>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <set>
+#include <cstdio>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+using namespace std;
+
+// same inode, same contents as far as the kernel's change times can tell
+static bool unchanged(const struct stat& then, const struct statx& now) {
+    return then.st_dev == makedev(now.stx_dev_major, now.stx_dev_minor) && then.st_ino == now.stx_ino
+        && (uintmax_t)then.st_size == now.stx_size
+        && then.st_mtim.tv_sec == now.stx_mtime.tv_sec && then.st_mtim.tv_nsec == (long)now.stx_mtime.tv_nsec
+        && then.st_ctim.tv_sec == now.stx_ctime.tv_sec && then.st_ctim.tv_nsec == (long)now.stx_ctime.tv_nsec;
+}
+
+// hash a file now, errno on failure
+static int hashPath(const string& path, Hash128& hash, uintmax_t& size) {
+    int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return errno;
+    int err = 0;
+    try {
+        hash = hashFd(fd, size);
+    } catch (const toss_exception&) {
+        err = errno == 0 ? EIO : errno;
+    }
+    close(fd);
+    return err;
+}
+
+// read up to size bytes, fewer only at the end of the file
+static ssize_t readFull(int fd, char* buf, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, buf + done, size - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+}
+
+// whether the stored object holds exactly the bytes of src, errno if either cannot be read;
+// a Hash128 match alone is not taken as proof, it is not a cryptographic hash
+static int sameContent(const string& src, const string& object, bool& same) {
+    same = false;
+    int in = open(src.c_str(), O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    if (in < 0) return errno;
+    int stored = open(object.c_str(), O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    if (stored < 0) {
+        int err = errno;
+        close(in);
+        return err == ELOOP ? 0 : err;
+    }
+
+    int err = 0;
+    struct stat a, b;
+    if (fstat(in, &a) != 0 || fstat(stored, &b) != 0) {
+        err = errno;
+    } else if (S_ISREG(b.st_mode) && a.st_size == b.st_size) {
+        statsCount("bytes compared", a.st_size);
+        posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+        posix_fadvise(stored, 0, 0, POSIX_FADV_SEQUENTIAL);
+        static thread_local vector<char> left(1 << 17), right(1 << 17);
+        for (;;) {
+            ssize_t n = readFull(in, left.data(), left.size());
+            ssize_t m = readFull(stored, right.data(), right.size());
+            if (n < 0 || m < 0) {
+                err = errno;
+                break;
+            }
+            if (n != m || memcmp(left.data(), right.data(), n) != 0) break;
+            if (n == 0) {
+                same = true;
+                break;
+            }
+        }
+    }
+    close(in);
+    close(stored);
+    return err;
+}
+
+ObjectStore& storeOf(ObjectStores& stores, const string& recycledir) {
+    return stores.try_emplace(recycledir, recycledir).first->second;
+}
+
+vector<StoredItem> storeBatch(const vector<TossItem>& items, HashAhead& hashes, Executor& exec, ObjectStores& stores,
+                              const BeforeMoves& beforeMoves) {
+    vector<StoredItem> result(items.size());
+
+    // 1. where everything is now, all stats in flight together (unless the caller has them)
+    vector<FsOp> stats;
+    vector<long> statOf(items.size(), -1);
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (items[i].statResult != 1) continue;
+        statOf[i] = stats.size();
+        stats.push_back(FsOp::statPath(items[i].src));
+    }
+    exec.run(stats);
+
+    // 2. the place of each item in its bin; a new objects/ab directory is made before the
+    //    renames into it, and an object already stored is never renamed over
+    Phase planning("plan objects");
+    vector<FsOp> ops;
+    vector<long> renameOf(items.size(), -1);
+    vector<char> isObject(items.size(), 0);
+    map<string, pair<long, ObjectStore*>> mkdirOf;
+    for (size_t i = 0; i < items.size(); ++i) {
+        StoredItem& stored = result[i];
+        const string& bin = items[i].bin;
+        ObjectStore& store = storeOf(stores, bin);
+        int statResult = statOf[i] < 0 ? items[i].statResult : stats[statOf[i]].result;
+        if (statResult != 0) {
+            stored.error = -statResult;
+            continue;
+        }
+        const struct statx& info = statOf[i] < 0 ? items[i].info : stats[statOf[i]].info;
+        stored.size = info.stx_size;
+
+        if (!S_ISREG(info.stx_mode)) {
+            stored.stored = store.newTreePath();
+            renameOf[i] = ops.size();
+            ops.push_back(FsOp::renamePath(items[i].src, bin + stored.stored));
+            continue;
+        }
+
+        Hash128 hash;
+        const PreparedObject* prepared = hashes.get(i);
+        if (prepared != nullptr && unchanged(prepared->info, info)) {
+            hash = prepared->hash;
+            stored.size = prepared->size;
+        } else if ((stored.error = hashPath(items[i].src, hash, stored.size)) != 0) {
+            continue;
+        }
+
+        string name = hash.hex();
+        string objects = bin + "/" + META_DIR + "/objects";
+        if (store.knownDirs.insert(objects).second) filesystem::create_directories(objects);
+        string parent = objects + "/" + name.substr(0, 2);
+        stored.stored = string("/") + META_DIR + "/objects/" + name.substr(0, 2) + "/" + name.substr(2);
+
+        long mkdir = -1;
+        if (store.knownDirs.count(parent) == 0) {
+            auto it = mkdirOf.find(parent);
+            if (it == mkdirOf.end()) {
+                it = mkdirOf.emplace(parent, make_pair((long)ops.size(), &store)).first;
+                ops.push_back(FsOp::makeDir(parent, 0777));
+            }
+            mkdir = it->second.first;
+        }
+        isObject[i] = 1;
+        renameOf[i] = ops.size();
+        ops.push_back(FsOp::renameNoReplace(items[i].src, bin + stored.stored, mkdir));
+    }
+    planning.end();
+    if (beforeMoves) beforeMoves(result);
+    exec.run(ops);
+    for (const auto& dir: mkdirOf) {
+        int made = ops[dir.second.first].result;
+        if (made == 0 || made == -EEXIST) dir.second.second->knownDirs.insert(dir.first);
+    }
+
+    // 3. content already stored is kept as it is, and the source removed once it is known to hold
+    //    the same bytes; other filesystems are copied
+    for (size_t i = 0; i < items.size(); ++i) {
+        StoredItem& stored = result[i];
+        if (renameOf[i] < 0) continue;
+        string dest = items[i].bin + stored.stored;
+        int err = -ops[renameOf[i]].result;
+
+        // the objects/ab directory was known but has been purged empty meanwhile: made again
+        if (isObject[i] && err == ENOENT) {
+            string parent = dest.substr(0, dest.rfind('/'));
+            set<string>& knownDirs = storeOf(stores, items[i].bin).knownDirs;
+            knownDirs.erase(parent);
+            if (mkdir(parent.c_str(), 0777) == 0 || errno == EEXIST) {
+                knownDirs.insert(parent);
+                err = renameat2(AT_FDCWD, items[i].src.c_str(), AT_FDCWD, dest.c_str(), RENAME_NOREPLACE) == 0 ? 0 : errno;
+            }
+        }
+
+        // another filesystem, or one without RENAME_NOREPLACE: looked up first, then moved
+        if (isObject[i] && (err == EXDEV || err == EINVAL)) {
+            struct stat info;
+            if (lstat(dest.c_str(), &info) == 0) {
+                err = EEXIST;
+            } else if (err == EINVAL) {
+                err = rename(items[i].src.c_str(), dest.c_str()) == 0 ? 0 : errno;
+            }
+        }
+        if (err == EXDEV) {
+            try {
+                movePath(items[i].src, dest);
+                err = 0;
+            } catch (const filesystem::filesystem_error& fail) {
+                err = fail.code().value();
+            }
+        } else if (isObject[i] && err == EEXIST) {
+            // different bytes under the same name stay where they are, the toss fails with EEXIST
+            bool same = false;
+            err = sameContent(items[i].src, dest, same);
+            if (err == 0 && !same) {
+                err = EEXIST;
+                statsCount("hash collisions");
+            } else if (err == 0) {
+                err = unlink(items[i].src.c_str()) == 0 ? 0 : errno;
+                stored.deduplicated = err == 0;
+            }
+        }
+        stored.error = err;
+        if (stored.deduplicated) statsCount("files deduplicated");
+    }
+    return result;
+}
+
+string ObjectStore::newTreePath() {
+    string trees = recycledir + "/" + META_DIR + "/trees";
+    if (knownDirs.insert(trees).second) filesystem::create_directories(trees);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    for (;;) {
+        string id = to_string(now.tv_sec) + "." + to_string(now.tv_nsec) + "-" + to_string(getpid()) + "-" + to_string(treeCount++);
+        struct stat info;
+        if (lstat((trees + "/" + id).c_str(), &info) != 0) {
+            return string("/") + META_DIR + "/trees/" + id;
+        }
+    }
+}
+
+bool isStoreEntry(const string& stored) {
+    return startsWith(stored, string("/") + META_DIR + "/");
+}
+
+/** Hash Ahead **/
+
+constexpr size_t WAIT_AHEAD = 256;
+
+struct HashAhead::State {
+    vector<string> paths;
+    vector<PreparedObject> results;
+    unique_ptr<atomic<char>[]> done;    // 0 pending, 1 hashed, 2 no hash
+    atomic<size_t> next{0};
+    atomic<bool> stop{false};
+    // a caller that has caught up waits for the hash it wants and for the one WAIT_AHEAD after
+    // it, so a wakeup (and the lock) is paid per stretch of files rather than per file; the
+    // moves only start once the whole batch is planned, so waiting longer costs nothing
+    static constexpr size_t NONE = SIZE_MAX;
+    atomic<size_t> awaited{NONE};
+    atomic<size_t> awaitedLast{NONE};
+    mutex lock;
+    condition_variable ready;
+    vector<thread> threads;
+
+    void run() {
+        for (;;) {
+            size_t i = next.fetch_add(1);
+            if (i >= paths.size() || stop.load()) return;
+
+            char outcome = 2;
+            // O_NONBLOCK so a fifo in the list cannot hang the open
+            int fd = open(paths[i].c_str(), O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+            if (fd >= 0) {
+                PreparedObject& result = results[i];
+                if (fstat(fd, &result.info) == 0 && S_ISREG(result.info.st_mode)) {
+                    try {
+                        result.hash = hashFd(fd, result.size, result.info.st_size);
+                        outcome = 1;
+                        statsCount("files hashed");
+                        statsCount("bytes hashed", result.size);
+                    } catch (const toss_exception&) {}
+                }
+                close(fd);
+            }
+
+            done[i].store(outcome);
+            if (awaited.load() == i || awaitedLast.load() == i) {
+                lock_guard<mutex> guard(lock);
+                ready.notify_all();
+            }
+        }
+    }
+};
+
+HashAhead::HashAhead(vector<string> paths, unsigned threads):state(make_unique<State>()) {
+    state->paths = move(paths);
+    state->results.resize(state->paths.size());
+    state->done = make_unique<atomic<char>[]>(state->paths.size());
+    threads = max(1u, min<unsigned>(threads, state->paths.size()));
+    if (state->paths.empty()) return;
+    for (unsigned t = 0; t < threads; ++t) state->threads.emplace_back(&State::run, state.get());
+}
+
+HashAhead::~HashAhead() {
+    state->stop = true;
+    for (auto& t: state->threads) t.join();
+}
+
+const PreparedObject* HashAhead::get(size_t i) {
+    if (state->done[i].load() == 0) {
+        Phase phase("wait for hashes");
+        size_t last = min(i + WAIT_AHEAD, state->paths.size() - 1);
+        unique_lock<mutex> guard(state->lock);
+        state->awaited.store(i);
+        state->awaitedLast.store(last);
+        state->ready.wait(guard, [&]{ return state->done[i].load() != 0 && state->done[last].load() != 0; });
+        state->awaited.store(State::NONE);
+        state->awaitedLast.store(State::NONE);
+    }
+    return state->done[i].load() == 1 ? &state->results[i] : nullptr;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <sys/stat.h>
+#include "hash.hpp"
+#include "executor.hpp"
+
+/**
+ * Layout of a recycle bin (paths relative to the bin):
+ *   /.toss/objects/ab/cdef...   regular files, named by the Hash128 of their content and
+ *                               stored once no matter how many paths or tosses refer to them
+ *   /.toss/trees/<id>           directories (and anything that is not a regular file), each
+ *                               toss moved in whole with one rename under a fresh id
+ *   /<original path>            bins from before versioning mirror the original location;
+ *                               these are still listed, recovered and purged
+ * The catalog records which original path and toss time each stored item belongs to.
+ */
+
+// content hash of a regular file taken ahead of the toss, with the file's stat at the time
+struct PreparedObject {
+    Hash128 hash;
+    uintmax_t size = 0;
+    struct stat info;
+};
+
+/**
+ * Hashes a list of files on background threads, in list order, while the caller works through
+ * the same list storing them: the caller's renames overlap the hashing of the files after them.
+ * Anything that is not a regular file, or cannot be read, gets no hash (get returns nullptr)
+ * and is left for storeBatch to deal with.
+ */
+class HashAhead {
+private:
+    struct State;
+    std::unique_ptr<State> state;
+
+public:
+    HashAhead(std::vector<std::string> paths, unsigned threads);
+    ~HashAhead();
+
+    // wait for the hash of paths[i]
+    const PreparedObject* get(size_t i);
+};
+
+// one non-directory to toss into bin
+struct TossItem {
+    std::string src;
+    std::string bin;
+    // lstat of src the caller already took through the executor: 0 or -errno, with the fields
+    // of STATX_BASIC_STATS in info; 1 leaves it to storeBatch
+    int statResult = 1;
+    struct statx info;
+};
+
+// result of storing one item, stored is relative to the recycle bin; error is an errno, 0 if stored
+struct StoredItem {
+    std::string stored;
+    uintmax_t size = 0;
+    bool deduplicated = false;
+    int error = 0;
+};
+
+/**
+ * What a run has learned about one bin's object store, kept by its owner (see Engine) for as
+ * long as it tosses into that bin
+ * - directories of the store known to exist, so each is created at most once per run; a purge
+ *   (in this process or another) may remove an emptied one since, see storeBatch
+ * - the number of trees handed out, part of each fresh tree id
+ */
+struct ObjectStore {
+    std::string recycledir;
+    std::set<std::string> knownDirs;
+    unsigned treeCount = 0;
+
+    ObjectStore(const std::string& recycledir):recycledir(recycledir){}
+
+    // fresh, unused /.toss/trees/<id> path for a directory or special file
+    std::string newTreePath();
+};
+
+// the object stores of every bin a run tosses into, by bin
+using ObjectStores = std::map<std::string, ObjectStore>;
+ObjectStore& storeOf(ObjectStores& stores, const std::string& recycledir);
+
+/**
+ * Toss a batch of non-directories: regular files into the object store, anything else into a
+ * fresh tree. The stats, directory creations and renames each go through exec as one batch, so
+ * the whole batch costs a few round trips rather than a few per file. An object already stored is
+ * never replaced: an item found to hold the same bytes is unlinked instead (its own mode, owner
+ * and times are for the caller to record, see CatalogEntry), and one whose bytes differ fails with EEXIST. Items fail
+ * independently, see StoredItem::error.
+ * beforeMoves is called with every item's planned place once all are known, before any is moved.
+ */
+using BeforeMoves = std::function<void(const std::vector<StoredItem>& planned)>;
+std::vector<StoredItem> storeBatch(const std::vector<TossItem>& items, HashAhead& hashes, Executor& exec, ObjectStores& stores,
+                                   const BeforeMoves& beforeMoves = {});
+
+// true if stored names an object or tree rather than a legacy mirrored path
+bool isStoreEntry(const std::string& stored);
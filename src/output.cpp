@@ -0,0 +1,204 @@
+#include "output.hpp"
+#include "toss.hpp"
+
+#include <ctime>
+#include <string.h>
+#include <unistd.h>
+using namespace std;
+
+static constexpr size_t BUFFER_SIZE = 1 << 16;
+
+/** Sizes **/
+
+void appendSize(string& out, uintmax_t bytes) {
+    if (bytes < 1024) {
+        out += to_string(bytes);
+        out += 'B';
+        return;
+    }
+
+    int unit = 0;
+    uintmax_t scale = 1;
+    while (unit < 6 && bytes / scale >= 1024) {
+        scale *= 1024;
+        ++unit;
+    }
+    unsigned __int128 tenths = ((unsigned __int128)bytes * 10 + scale - 1) / scale;
+    out += to_string((uintmax_t)(tenths / 10));
+    if (tenths % 10 != 0) {
+        out += '.';
+        out += char('0' + (int)(tenths % 10));
+    }
+    out += "BKMGTPE"[unit];
+    out += "B (";
+    out += to_string(bytes);
+    out += ')';
+}
+
+string humanSize(uintmax_t bytes) {
+    string out;
+    appendSize(out, bytes);
+    return out;
+}
+
+/** Dates **/
+
+static void twoDigits(char* at, long value) {
+    at[0] = char('0' + value / 10);
+    at[1] = char('0' + value % 10);
+}
+
+const char* TimeText::of(long time) {
+    if (time >= dayStart && time < dayEnd) {
+        long seconds = time - dayStart;
+        size_t length = strlen(dayText);
+        memcpy(text, dayText, length);
+        twoDigits(text + length, seconds / 3600);
+        text[length + 2] = ':';
+        twoDigits(text + length + 3, seconds / 60 % 60);
+        text[length + 5] = ':';
+        twoDigits(text + length + 6, seconds % 60);
+        strcpy(text + length + 8, yearText);
+        return text;
+    }
+
+    time_t t = time;
+    struct tm local;
+    localtime_r(&t, &local);
+    strftime(text, sizeof(text), "%a %b %e %H:%M:%S %Y", &local);
+
+    // keep this day, unless its UTC offset changes somewhere in it
+    dayStart = time - (local.tm_hour * 3600L + local.tm_min * 60L + local.tm_sec);
+    dayEnd = dayStart + 86400;
+    struct tm edge;
+    time_t first = dayStart, last = dayEnd - 1;
+    if (localtime_r(&first, &edge) == nullptr || edge.tm_gmtoff != local.tm_gmtoff
+        || localtime_r(&last, &edge) == nullptr || edge.tm_gmtoff != local.tm_gmtoff) {
+        dayEnd = dayStart;
+    }
+    strftime(dayText, sizeof(dayText), "%a %b %e ", &local);
+    strftime(yearText, sizeof(yearText), " %Y", &local);
+    return text;
+}
+
+/** Listing Output **/
+
+ListWriter::ListWriter(int fd, Format format):fd(fd), format(format) {
+    buffer.reserve(BUFFER_SIZE + 4096);
+}
+
+ListWriter::~ListWriter() {
+    try {
+        finish();
+    } catch (const toss_exception&) {}
+}
+
+void ListWriter::pad(size_t from, size_t width) {
+    size_t written = buffer.size() - from;
+    if (written < width) buffer.append(width - written, ' ');
+}
+
+static void appendJsonString(string& out, string_view text) {
+    static const char* hex = "0123456789abcdef";
+    out += '"';
+    for (char c: text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            out += "\\u00";
+            out += hex[(unsigned char)c >> 4];
+            out += hex[c & 0xf];
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+void ListWriter::header() {
+    switch (format) {
+        case Table: {
+            size_t start = buffer.size();
+            buffer += "Date Tossed";
+            pad(start, 30);
+            start = buffer.size();
+            buffer += "Filename";
+            pad(start, 50);
+            buffer += "Size\n\n";
+            break;
+        }
+        case Tsv:
+            buffer += "time\tsize\tpath\n";
+            break;
+        case Json:
+            buffer += '[';
+            break;
+    }
+}
+
+void ListWriter::row(long time, string_view path, uintmax_t size) {
+    switch (format) {
+        case Table: {
+            size_t start = buffer.size();
+            buffer += dates.of(time);
+            pad(start, 30);
+            start = buffer.size();
+            buffer += path;
+            pad(start, 50);
+            appendSize(buffer, size);
+            buffer += '\n';
+            break;
+        }
+        case Tsv:
+            buffer += to_string(time);
+            buffer += '\t';
+            buffer += to_string(size);
+            buffer += '\t';
+            escapeField(buffer, path);
+            buffer += '\n';
+            break;
+        case Json:
+            buffer += rows == 0 ? "\n" : ",\n";
+            buffer += "{\"time\":";
+            buffer += to_string(time);
+            buffer += ",\"size\":";
+            buffer += to_string(size);
+            buffer += ",\"path\":";
+            appendJsonString(buffer, path);
+            buffer += '}';
+            break;
+    }
+    ++rows;
+    if (buffer.size() >= BUFFER_SIZE) flush();
+}
+
+void ListWriter::finish() {
+    if (finished) return;
+    finished = true;
+    if (format == Json) buffer += rows == 0 ? "]\n" : "\n]\n";
+    flush();
+}
+
+void ListWriter::flush() {
+    const char* p = buffer.data();
+    size_t left = buffer.size();
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            buffer.clear();
+            throw toss_exception(string("cannot write listing: ") + strerror(errno));
+        }
+        p += n;
+        left -= n;
+    }
+    buffer.clear();
+}
+
+ListWriter::Format parseFormat(const string& name) {
+    if (name == "table") return ListWriter::Table;
+    if (name == "tsv") return ListWriter::Tsv;
+    if (name == "json") return ListWriter::Json;
+    throw toss_exception("unknown format " + name + ", expected table, tsv or json");
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+// human readable size as listings show it, "512B", "1.5KB (1536)": bytes scaled by 1024 and
+// rounded up to a tenth, in integer arithmetic
+void appendSize(std::string& out, uintmax_t bytes);
+std::string humanSize(uintmax_t bytes);
+
+/**
+ * ctime() text of a toss time, without the newline
+ * - the local day the last time fell in is kept, so the text of any time in that day is put
+ *   together arithmetically, localtime_r() runs once per day rather than once per row
+ * - a day whose UTC offset changes (a DST switch) is not kept, each of its times is converted
+ */
+class TimeText {
+private:
+    long dayStart = 0;
+    long dayEnd = 0;            // empty range: no day kept
+    char dayText[16];           // "Sat Oct 17 "
+    char yearText[8];           // " 2026"
+    char text[32] = "";
+
+public:
+    const char* of(long time);
+};
+
+/**
+ * Buffered writer of listings on a file descriptor
+ * - rows are formatted straight into one 64KB buffer that is written out when full, so a big
+ *   listing costs a write per 64KB instead of a flush per line
+ * - Table is the aligned listing for people; Tsv and Json are for scripts, with times as
+ *   seconds since the epoch and sizes in bytes
+ *     Tsv:  a "time size path" header, then one row per item, paths escaped as in the catalog
+ *     Json: an array of {"time":..., "size":..., "path":"..."} objects
+ * Directories tossed whole are listed with a trailing "/" in every format.
+ */
+class ListWriter {
+public:
+    enum Format { Table, Tsv, Json };
+
+private:
+    int fd;
+    Format format;
+    std::string buffer;
+    TimeText dates;
+    size_t rows = 0;
+    bool finished = false;
+
+    void pad(size_t from, size_t width);
+
+public:
+    ListWriter(int fd, Format format);
+    ~ListWriter();
+
+    void header();
+    void row(long time, std::string_view path, uintmax_t size);
+
+    // close the listing and write out everything buffered
+    void finish();
+    void flush();
+};
+
+// "table", "tsv" or "json", throws toss_exception on anything else
+ListWriter::Format parseFormat(const std::string& name);
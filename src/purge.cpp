@@ -0,0 +1,226 @@
+#include "purge.hpp"
+#include "toss.hpp"
+#include "stats.hpp"
+
+#include <map>
+#include <functional>
+#include <set>
+#include <algorithm>
+#include <vector>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+using namespace std;
+
+// remove name (below parentfd) and everything in it, returns the number of files removed
+static uintmax_t removeTreeAt(int parentfd, const string& name, const string& path) {
+    int fd = openat(parentfd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) return 0;
+        if (errno == ENOTDIR || errno == ELOOP) {
+            return unlinkat(parentfd, name.c_str(), 0) == 0 ? 1 : 0;
+        }
+        throw toss_exception("cannot open " + path + ": " + strerror(errno));
+    }
+    DIR* dir = fdopendir(fd);
+    if (dir == nullptr) {
+        close(fd);
+        throw toss_exception("cannot read " + path + ": " + strerror(errno));
+    }
+
+    uintmax_t files = 0;
+    while (struct dirent* entry = readdir(dir)) {
+        const char* child = entry->d_name;
+        if (child[0] == '.' && (child[1] == '\0' || (child[1] == '.' && child[2] == '\0'))) continue;
+
+        bool isDir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat info;
+            isDir = fstatat(fd, child, &info, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(info.st_mode);
+        }
+        if (isDir) {
+            files += removeTreeAt(fd, child, path + "/" + child);
+        } else if (unlinkat(fd, child, 0) == 0) {
+            files += 1;
+        }
+    }
+    closedir(dir);
+
+    if (unlinkat(parentfd, name.c_str(), AT_REMOVEDIR) != 0 && errno != ENOENT) {
+        throw toss_exception("cannot remove " + path + ": " + strerror(errno));
+    }
+    return files;
+}
+
+static string parentOf(const string& stored) {
+    size_t slash = stored.rfind('/');
+    return slash == string::npos ? "" : stored.substr(0, slash);
+}
+
+static bool isObject(const string& stored) {
+    return startsWith(stored, string("/") + META_DIR + "/objects/");
+}
+
+// delete the candidates that are still live, oldest first while wanted() agrees; candidates are
+// read from the catalog's head and may have been recovered, purged or resized since
+// taken: set to the number of candidates gone through before wanted() declined one
+static PurgeResult removeEntries(const string& recycledir, Catalog& catalog, const vector<CatalogEntry>& candidates,
+                                 const function<bool(const CatalogEntry&)>& wanted = {}, size_t* taken = nullptr) {
+    Phase phase("remove items");
+    PurgeResult result;
+    if (candidates.empty()) return result;
+
+    // whether an object is still referenced is only settled once no toss can be storing it,
+    // and the watcher only looks at what is deleted here once its records are written
+    vector<string> scope;
+    for (const auto& entry: candidates) scope.push_back(entry.stored);
+    catalog.lockShards(scope);
+    catalog.refresh(scope);
+
+    // grouped by the directory the items sit in, as they are now (a record read twice, once
+    // for each of its updates, is taken once)
+    vector<CatalogEntry> victims;
+    size_t looked = 0;
+    for (; looked < candidates.size(); ++looked) {
+        CatalogEntry entry = candidates[looked];
+        if (!catalog.current(entry)) continue;
+        if (wanted && !wanted(entry)) break;
+        victims.push_back(move(entry));
+    }
+    if (taken != nullptr) *taken = looked;
+    statsCount("items removed", victims.size());
+    map<string, vector<const CatalogEntry*>> byParent;
+    for (const auto& entry: victims) {
+        byParent[parentOf(entry.stored)].push_back(&entry);
+    }
+
+    // an entry's purge is recorded once its item is deleted (or found gone), so a failure
+    // part way leaves every entry not yet dealt with live
+    auto fail = [&](const string& message) {
+        catalog.flush();
+        catalog.unlockShards();
+        throw toss_exception(message);
+    };
+    for (const auto& group: byParent) {
+        string parent = recycledir + group.first;
+        int fd = open(parent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            // the whole directory is already gone, nothing left to delete
+            if (errno != ENOENT) fail("cannot open " + parent + ": " + strerror(errno));
+            for (const auto* entry: group.second) catalog.recordPurge(*entry);
+            continue;
+        }
+
+        for (const auto* entry: group.second) {
+            string name = entry->stored.substr(group.first.size() + 1);
+
+            // an object stays while another path or toss still refers to its content
+            if (isObject(entry->stored) && catalog.references(entry->stored) > 1) {
+                catalog.recordPurge(*entry);
+                continue;
+            }
+
+            // only what was still there counts as freed
+            struct stat info;
+            if (entry->type == 'd') {
+                if (fstatat(fd, name.c_str(), &info, AT_SYMLINK_NOFOLLOW) == 0) {
+                    try {
+                        result.files += removeTreeAt(fd, name, recycledir + entry->stored);
+                    } catch (const toss_exception& e) {
+                        close(fd);
+                        fail(e.what());
+                    }
+                    result.bytes += entry->size;
+                }
+            } else if (unlinkat(fd, name.c_str(), 0) == 0) {
+                result.files += 1;
+                result.bytes += entry->size;
+            } else if (errno != ENOENT) {
+                int err = errno;
+                close(fd);
+                fail("cannot remove " + recycledir + entry->stored + ": " + strerror(err));
+            }
+            catalog.recordPurge(*entry);
+        }
+        close(fd);
+    }
+
+    // remove directories the purge left empty, deepest first, stopping at the first one still in use
+    // and never removing the store's own top level directories
+    const string meta = string("/") + META_DIR;
+    set<string> emptied;
+    for (const auto& group: byParent) emptied.insert(group.first);
+    for (auto it = emptied.rbegin(); it != emptied.rend(); ++it) {
+        for (string dir = *it; !dir.empty() && dir != meta && dir != meta + "/objects" && dir != meta + "/trees"; dir = parentOf(dir)) {
+            if (rmdir((recycledir + dir).c_str()) != 0) break;
+        }
+    }
+
+    catalog.flush();
+    catalog.unlockShards();
+    return result;
+}
+
+PurgeResult purgeBin(const string& recycledir, Catalog& catalog, long cutoff) {
+    // the expired records are a prefix of the log: read up to the first one tossed after cutoff
+    CatalogHead head = catalog.head();
+    vector<CatalogEntry> candidates;
+    for (CatalogEntry entry; ; ) {
+        size_t at = head.offset();
+        if (!head.next(entry)) break;
+        if (entry.toss_time > cutoff) {
+            head.rewind(at);
+            break;
+        }
+        candidates.push_back(move(entry));
+    }
+    PurgeResult result = removeEntries(recycledir, catalog, candidates);
+    catalog.settleHead(head);
+
+    // drop the recovered and purged records once they are most of the log
+    if (head.offset() * 2 > head.size()) catalog.compact();
+    return result;
+}
+
+PurgeResult evictBin(const string& recycledir, Catalog& catalog, uintmax_t quota, long keepFrom) {
+    if (quota == 0) return {};
+    uintmax_t used = catalog.usage();
+    if (used <= quota) return {};
+
+    PurgeResult result;
+    CatalogHead head = catalog.head();
+    while (used > quota) {
+        // the oldest records covering what is over quota, more are read if some of them are gone
+        vector<CatalogEntry> candidates;
+        vector<size_t> offsets;
+        uintmax_t listed = 0;
+        for (CatalogEntry entry; listed < used - quota; ) {
+            size_t at = head.offset();
+            if (!head.next(entry)) break;
+            if (entry.toss_time >= keepFrom) {
+                head.rewind(at);
+                break;
+            }
+            listed += entry.size;
+            offsets.push_back(at);
+            candidates.push_back(move(entry));
+        }
+        if (candidates.empty()) break;
+
+        size_t taken = 0;
+        PurgeResult removed = removeEntries(recycledir, catalog, candidates, [&](const CatalogEntry& entry) {
+            if (used <= quota) return false;
+            used -= min(used, entry.size);
+            return true;
+        }, &taken);
+
+        // the records after the last one taken are read again by the next eviction
+        if (taken < candidates.size()) head.rewind(offsets[taken]);
+        result.bytes += removed.bytes;
+        result.files += removed.files;
+    }
+    catalog.settleHead(head);
+    return result;
+}
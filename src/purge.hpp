@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+#include "catalog.hpp"
+
+struct PurgeResult {
+    uintmax_t bytes = 0;
+    uintmax_t files = 0;
+};
+
+/**
+ * Permanently delete everything in a recycle bin tossed at or before cutoff.
+ * The catalog is in toss order, so only the expired prefix is ever read (from the catalog's
+ * head, past the records earlier purges settled) and touched: files are unlinked in batches per
+ * parent directory, directories are removed through their fds, and directories left empty are
+ * removed up to the bin itself. Only what was actually deleted counts as freed, objects still
+ * referenced by other entries are kept.
+ */
+PurgeResult purgeBin(const std::string& recycledir, Catalog& catalog, long cutoff);
+
+/**
+ * Bring a recycle bin back under quota bytes by deleting the oldest items first.
+ * The check is a read of the bin's usage file; only when the bin is over quota is the catalog
+ * read, from its head and only as far as the records covering the excess, so the cost follows
+ * what is evicted rather than the size of the catalog. Items tossed at or after keepFrom (the
+ * toss in progress) are never evicted.
+ */
+PurgeResult evictBin(const std::string& recycledir, Catalog& catalog, uintmax_t quota, long keepFrom);
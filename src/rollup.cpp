@@ -0,0 +1,212 @@
+#include "rollup.hpp"
+#include "catalog.hpp"
+#include "toss.hpp"
+
+#include <filesystem>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+using namespace std;
+
+static constexpr const char* TOTALS = "@";
+
+// the directories an item counts towards, outermost first
+static vector<string> directoriesOf(const CatalogEntry& entry) {
+    vector<string> dirs{"/"};
+    const string& path = entry.original;
+    for (size_t slash = path.find('/', 1); slash != string::npos; slash = path.find('/', slash + 1)) {
+        dirs.push_back(path.substr(0, slash));
+    }
+    if (entry.type == 'd' && path.size() > 1) dirs.push_back(path);
+    return dirs;
+}
+
+static string nodePath(const string& base, const string& dir) {
+    string node = base;
+    size_t start = 1;
+    while (start < dir.size()) {
+        size_t slash = dir.find('/', start);
+        if (slash == string::npos) slash = dir.size();
+        node += '/';
+        if (dir[start] == '@') node += '@';
+        node.append(dir, start, slash - start);
+        start = slash + 1;
+    }
+    return node;
+}
+
+static bool readNode(const string& node, DirTotals& totals) {
+    int fd = open((node + "/" + TOTALS).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    char buf[128];
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return false;
+    buf[n] = '\0';
+    return sscanf(buf, "%ju %ju %ld %ju", &totals.bytes, &totals.items, &totals.oldest, &totals.atOldest) == 4;
+}
+
+// one fixed width record written over the old one, never a truncated file in between
+static void writeNode(const string& node, const DirTotals& totals) {
+    string path = node + "/" + TOTALS;
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) throw toss_exception("failed to write totals " + path + ": " + strerror(errno));
+    char buf[96];
+    int length = snprintf(buf, sizeof(buf), "%20ju %20ju %20ld %20ju\n", totals.bytes, totals.items, totals.oldest, totals.atOldest);
+    ssize_t n = pwrite(fd, buf, length, 0);
+    close(fd);
+    if (n != length) throw toss_exception("failed to write totals " + path + ": " + strerror(errno));
+}
+
+static void makeNode(const string& node) {
+    if (mkdir(node.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw toss_exception("failed to create totals " + node + ": " + strerror(errno));
+    }
+}
+
+Rollup::Rollup(const string& recycledir):root(metaPath(recycledir, "du")){}
+
+string Rollup::nodeOf(const string& dir) const {
+    return nodePath(root, dir);
+}
+
+bool Rollup::exists() const {
+    return access(root.c_str(), F_OK) == 0;
+}
+
+void Rollup::count(const CatalogEntry& entry, long long bytes, long long items) {
+    for (const auto& dir: directoriesOf(entry)) {
+        Delta& delta = pending[dir];
+        delta.bytes += bytes;
+        delta.items += items;
+        if (items != 0) delta.times[entry.toss_time] += items;
+    }
+}
+
+void Rollup::discard() {
+    pending.clear();
+}
+
+void Rollup::apply() {
+    if (pending.empty()) return;
+    if (!exists()) {
+        // nothing to keep up to date, Catalog::du() builds the totals from the catalog
+        pending.clear();
+        return;
+    }
+
+    // a parent sorts before its children, so it is created first and removed last
+    vector<string> emptied;
+    for (const auto& [dir, delta]: pending) {
+        string node = nodeOf(dir);
+        DirTotals totals;
+        bool had = readNode(node, totals) && totals.items > 0;
+        long long items = (had ? (long long)totals.items : 0) + delta.items;
+        long long bytes = (had ? (long long)totals.bytes : 0) + delta.bytes;
+        if (items <= 0) {
+            if (had) emptied.push_back(node);
+            continue;
+        }
+
+        if (!had) {
+            totals = DirTotals();
+        } else {
+            for (const auto& [time, count]: delta.times) {
+                if (count < 0 && time == totals.oldest) totals.atOldest -= min<uintmax_t>(totals.atOldest, -count);
+            }
+        }
+        bool known = !had || totals.atOldest > 0;
+        for (const auto& [time, count]: delta.times) {
+            if (count <= 0) continue;
+            if (!had && totals.atOldest == 0) {
+                totals.oldest = time;
+                totals.atOldest = count;
+            } else if (known && time < totals.oldest) {
+                totals.oldest = time;
+                totals.atOldest = count;
+            } else if (known && time == totals.oldest) {
+                totals.atOldest += count;
+            }
+        }
+        totals.items = items;
+        totals.bytes = bytes < 0 ? 0 : bytes;
+
+        if (!had) makeNode(node);
+        writeNode(node, totals);
+    }
+    pending.clear();
+
+    for (auto it = emptied.rbegin(); it != emptied.rend(); ++it) {
+        unlink((*it + "/" + TOTALS).c_str());
+        rmdir(it->c_str());
+    }
+}
+
+void Rollup::build(const vector<CatalogEntry>& entries) {
+    map<string, DirTotals> all;
+    for (const auto& entry: entries) {
+        for (const auto& dir: directoriesOf(entry)) {
+            DirTotals& totals = all[dir];
+            if (totals.items == 0 || entry.toss_time < totals.oldest) {
+                totals.oldest = entry.toss_time;
+                totals.atOldest = 0;
+            }
+            if (entry.toss_time == totals.oldest) ++totals.atOldest;
+            totals.bytes += entry.size;
+            ++totals.items;
+        }
+    }
+
+    // built beside the old tree and swapped in
+    string fresh = root + ".new";
+    string old = root + ".old";
+    error_code ec;
+    filesystem::remove_all(fresh, ec);
+    filesystem::remove_all(old, ec);
+    makeNode(fresh);
+    for (const auto& [dir, totals]: all) {
+        string node = nodePath(fresh, dir);
+        if (dir != "/") makeNode(node);
+        writeNode(node, totals);
+    }
+    if (exists() && rename(root.c_str(), old.c_str()) != 0) {
+        throw toss_exception("failed to replace totals " + root + ": " + strerror(errno));
+    }
+    if (rename(fresh.c_str(), root.c_str()) != 0) {
+        throw toss_exception("failed to replace totals " + root + ": " + strerror(errno));
+    }
+    filesystem::remove_all(old, ec);
+    pending.clear();
+}
+
+void Rollup::setOldest(const string& dir, long oldest, uintmax_t atOldest) {
+    string node = nodeOf(dir);
+    DirTotals totals;
+    if (!readNode(node, totals)) return;
+    totals.oldest = oldest;
+    totals.atOldest = atOldest;
+    writeNode(node, totals);
+}
+
+bool Rollup::read(const string& dir, DirTotals& totals) const {
+    return readNode(nodeOf(dir), totals) && totals.items > 0;
+}
+
+vector<pair<string, DirTotals>> Rollup::children(const string& dir) const {
+    vector<pair<string, DirTotals>> result;
+    string node = nodeOf(dir);
+    DIR* listing = opendir(node.c_str());
+    if (listing == nullptr) return result;
+    while (struct dirent* entry = readdir(listing)) {
+        string name = entry->d_name;
+        if (name == "." || name == ".." || name == TOTALS) continue;
+        DirTotals totals;
+        if (!readNode(node + "/" + name, totals) || totals.items == 0) continue;
+        if (name[0] == '@') name.erase(0, 1);
+        result.emplace_back(dir == "/" ? "/" + name : dir + "/" + name, totals);
+    }
+    closedir(listing);
+    return result;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <cstdint>
+
+struct CatalogEntry;
+
+// what is tossed from below one original directory
+struct DirTotals {
+    uintmax_t bytes = 0;
+    uintmax_t items = 0;
+    long oldest = 0;            // toss time of the oldest item
+    uintmax_t atOldest = 0;     // items tossed at that time; 0 with items left means oldest is unknown
+};
+
+/**
+ * Per directory totals of a recycle bin, kept at <recycledir>/.toss/du as a tree of directories
+ * mirroring the original ones: the totals of /home/x are in .toss/du/home/x/@
+ * - an item counts towards every directory above its original path, a directory tossed whole
+ *   towards itself as well
+ * - the catalog hands over the changes of each batch as it flushes, so keeping them costs
+ *   one small write per directory the batch touched, and reading one costs a single open
+ * - a child named "@..." is kept as "@@..." so it can never clash with the totals file
+ * - the oldest toss is exact until the items tossed at that time are gone; it is then
+ *   marked unknown and the catalog works it out again the next time it is asked for
+ */
+class Rollup {
+private:
+    struct Delta {
+        long long bytes = 0;
+        long long items = 0;
+        std::map<long, long long> times;    // items added (+) and removed (-) per toss time
+    };
+
+    std::string root;
+    std::map<std::string, Delta> pending;
+
+    std::string nodeOf(const std::string& dir) const;
+
+public:
+    Rollup(const std::string& recycledir);
+
+    // false for a bin from before totals were kept, see Catalog::du()
+    bool exists() const;
+
+    // an item's bytes and count changed by this much, written out by apply()
+    void count(const CatalogEntry& entry, long long bytes, long long items);
+    void discard();
+
+    // the caller holds the bin's usage lock
+    void apply();
+    void build(const std::vector<CatalogEntry>& entries);
+    void setOldest(const std::string& dir, long oldest, uintmax_t atOldest);
+
+    bool read(const std::string& dir, DirTotals& totals) const;
+
+    // immediate subdirectories of dir that hold tossed items, by absolute path
+    std::vector<std::pair<std::string, DirTotals>> children(const std::string& dir) const;
+};
@@ -0,0 +1,202 @@
+#include "scanner.hpp"
+#include "stats.hpp"
+
+#include <filesystem>
+#include <system_error>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+using namespace std;
+
+static unsigned configuredThreads = 0;
+
+void setScanThreads(unsigned threads) {
+    configuredThreads = threads;
+}
+
+unsigned scanThreads() {
+    if (configuredThreads > 0) return configuredThreads;
+    unsigned cpus = thread::hardware_concurrency();
+    return cpus == 0 ? 1 : min(cpus, 16u);
+}
+
+namespace {
+
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// an open directory, closed once the last child queued from it has been opened
+struct Dir {
+    int fd;
+    Dir(int fd):fd(fd){}
+    ~Dir() { if (fd >= 0) close(fd); }
+};
+
+struct Task {
+    shared_ptr<Dir> parent;
+    string name;
+    string path;
+};
+
+struct Worker {
+    mutex lock;
+    deque<Task> tasks;
+};
+
+class Walk {
+private:
+    const ScanVisitor& visit;
+    const ScanPrune& prune;
+    vector<unique_ptr<Worker>> workers;
+    atomic<size_t> outstanding{0};
+    mutex idleLock;
+    condition_variable idle;
+    mutex errorLock;
+    error_code error;
+    string errorPath;
+
+    void push(unsigned self, Task task) {
+        outstanding.fetch_add(1);
+        {
+            lock_guard<mutex> guard(workers[self]->lock);
+            workers[self]->tasks.push_back(move(task));
+        }
+        idle.notify_one();
+    }
+
+    bool pop(unsigned self, Task& task) {
+        // own work first, newest first for locality
+        {
+            lock_guard<mutex> guard(workers[self]->lock);
+            if (!workers[self]->tasks.empty()) {
+                task = move(workers[self]->tasks.back());
+                workers[self]->tasks.pop_back();
+                return true;
+            }
+        }
+        // then steal the oldest (largest subtree) from someone else
+        for (size_t i = 1; i < workers.size(); ++i) {
+            Worker& victim = *workers[(self + i) % workers.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void fail(const string& path) {
+        lock_guard<mutex> guard(errorLock);
+        if (!error) {
+            error = error_code(errno, system_category());
+            errorPath = path;
+        }
+    }
+
+    void readDirectory(unsigned self, Task& task) {
+        int fd = openat(task.parent ? task.parent->fd : AT_FDCWD, task.name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        task.parent.reset();
+        if (fd < 0) {
+            fail(task.path);
+            return;
+        }
+        auto dir = make_shared<Dir>(fd);
+
+        alignas(linux_dirent64) char buf[1 << 16];
+        string path;
+        struct stat info;
+        for (;;) {
+            long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                fail(task.path);
+                return;
+            }
+            if (n == 0) break;
+
+            for (long offset = 0; offset < n; ) {
+                auto entry = reinterpret_cast<linux_dirent64*>(buf + offset);
+                offset += entry->d_reclen;
+                const char* name = entry->d_name;
+                if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+                path.assign(task.path);
+                if (path.back() != '/') path += '/';
+                path += name;
+
+                if (entry->d_type == DT_DIR) {
+                    if (!prune || !prune(path)) push(self, {dir, name, path});
+                    continue;
+                }
+                if (fstatat(fd, name, &info, AT_SYMLINK_NOFOLLOW) != 0) {
+                    if (errno != ENOENT) fail(path);
+                    continue;
+                }
+                if (S_ISDIR(info.st_mode)) {
+                    // filesystems that leave d_type as DT_UNKNOWN
+                    if (!prune || !prune(path)) push(self, {dir, name, path});
+                    continue;
+                }
+                visit(self, ScanEntry{path, info});
+            }
+        }
+    }
+
+    void run(unsigned self) {
+        Task task;
+        for (;;) {
+            if (pop(self, task)) {
+                readDirectory(self, task);
+                task = Task();
+                if (outstanding.fetch_sub(1) == 1) {
+                    idle.notify_all();
+                    return;
+                }
+                continue;
+            }
+            if (outstanding.load() == 0) return;
+
+            // nothing to steal right now, wait for a push or the end of the walk
+            unique_lock<mutex> guard(idleLock);
+            idle.wait_for(guard, chrono::milliseconds(1));
+        }
+    }
+
+public:
+    Walk(const ScanVisitor& visit, const ScanPrune& prune, unsigned threads):visit(visit), prune(prune) {
+        for (unsigned i = 0; i < threads; ++i) workers.push_back(make_unique<Worker>());
+    }
+
+    void start(const string& root) {
+        push(0, {nullptr, root, root});
+        vector<thread> threads;
+        for (unsigned i = 1; i < workers.size(); ++i) threads.emplace_back(&Walk::run, this, i);
+        run(0);
+        for (auto& t: threads) t.join();
+
+        if (error) throw filesystem::filesystem_error("cannot scan", errorPath, error);
+    }
+};
+
+}
+
+void scanTree(const string& root, const ScanVisitor& visit, const ScanPrune& prune) {
+    Phase phase("scan tree");
+    Walk(visit, prune, scanThreads()).start(root);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+#include <functional>
+#include <sys/stat.h>
+
+// one non-directory entry found by scanTree, info is from fstatat(AT_SYMLINK_NOFOLLOW)
+struct ScanEntry {
+    const std::string& path;
+    const struct stat& info;
+};
+
+/**
+ * Called for every non-directory entry below the root. Calls come from several threads at
+ * once; worker is the index of the calling thread (0 <= worker < scanThreads()) so callers
+ * can keep one accumulator per worker and merge them afterwards without locking.
+ */
+using ScanVisitor = std::function<void(unsigned worker, const ScanEntry& entry)>;
+
+// return true to leave a directory (given by full path) out of the scan
+using ScanPrune = std::function<bool(const std::string& dir)>;
+
+/**
+ * Walk the tree under root on scanThreads() threads.
+ * - each directory is read with getdents64 on its own fd, and children are opened and
+ *   stat'ed relative to it (openat / fstatat), so no full path is ever looked up again
+ * - every worker keeps a deque of directories, working depth first off the back of its own
+ *   and stealing from the front of the others when it runs dry
+ * Symlinks are reported, never followed. The first error is thrown once the walk finishes.
+ */
+void scanTree(const std::string& root, const ScanVisitor& visit, const ScanPrune& prune = {});
+
+// thread count for scanTree, 0 picks one per CPU
+void setScanThreads(unsigned threads);
+unsigned scanThreads();
@@ -0,0 +1,136 @@
+#include "select.hpp"
+#include "toss.hpp"
+
+#include <string.h>
+using namespace std;
+
+/** Glob **/
+
+// index of the "]" closing the class opened at glob[open], npos if it is not a class
+static size_t classEnd(const string& glob, size_t open) {
+    size_t i = open + 1;
+    if (i < glob.size() && (glob[i] == '!' || glob[i] == '^')) ++i;
+    if (i < glob.size() && glob[i] == ']') ++i;     // a leading "]" is a member
+    for (; i < glob.size(); ++i) {
+        if (glob[i] == '\\') ++i;
+        else if (glob[i] == ']') return i;
+    }
+    return string::npos;
+}
+
+static bool inClass(const string& glob, size_t open, size_t close, unsigned char c) {
+    size_t i = open + 1;
+    bool negate = glob[i] == '!' || glob[i] == '^';
+    if (negate) ++i;
+    bool found = false;
+    for (bool first = true; i < close && (first || glob[i] != ']'); first = false) {
+        unsigned char lo = glob[i] == '\\' ? glob[++i] : glob[i];
+        unsigned char hi = lo;
+        if (i + 2 < close && glob[i + 1] == '-') {
+            i += 2;
+            hi = glob[i] == '\\' ? glob[++i] : glob[i];
+        }
+        if (lo <= c && c <= hi) found = true;
+        ++i;
+    }
+    return found != negate;
+}
+
+static bool globAt(const string& glob, size_t g, const string& path, size_t p) {
+    while (g < glob.size()) {
+        char c = glob[g];
+        if (c == '*') {
+            bool deep = g + 1 < glob.size() && glob[g + 1] == '*';
+            size_t next = g + (deep ? 2 : 1);
+            while (next < glob.size() && glob[next] == '*') ++next;
+
+            // "/**/" also matches a single "/"
+            if (deep && next < glob.size() && glob[next] == '/' && globAt(glob, next + 1, path, p)) return true;
+            for (size_t q = p; ; ++q) {
+                if (globAt(glob, next, path, q)) return true;
+                if (q >= path.size() || (!deep && path[q] == '/')) return false;
+            }
+        }
+        if (p >= path.size()) return false;
+
+        if (c == '?') {
+            if (path[p] == '/') return false;
+        } else if (c == '[' && classEnd(glob, g) != string::npos) {
+            size_t close = classEnd(glob, g);
+            if (path[p] == '/' || !inClass(glob, g, close, path[p])) return false;
+            g = close;
+        } else {
+            if (c == '\\' && g + 1 < glob.size()) c = glob[++g];
+            if (c != path[p]) return false;
+        }
+        ++g;
+        ++p;
+    }
+    return p == path.size();
+}
+
+/** Regex **/
+
+// the text every match of an anchored regex starts with, empty when that is not plain to see
+static string regexPrefix(const string& pattern) {
+    string literal;
+    if (pattern.empty() || pattern[0] != '^' || pattern.find('|') != string::npos) return literal;
+    for (size_t i = 1; i < pattern.size(); ) {
+        char c = pattern[i];
+        size_t width = 1;
+        if (c == '\\') {
+            if (i + 1 >= pattern.size() || isalnum((unsigned char)pattern[i + 1])) break;
+            c = pattern[i + 1];
+            width = 2;
+        } else if (strchr(".[]()*+?{}|^$", c) != nullptr) {
+            break;
+        }
+
+        // a repeated character may not be there at all
+        char after = i + width < pattern.size() ? pattern[i + width] : '\0';
+        if (after == '*' || after == '?' || after == '{') break;
+        literal += c;
+        if (after == '+') break;
+        i += width;
+    }
+    return literal;
+}
+
+static void freeRegex(regex_t* compiled) {
+    if (compiled == nullptr) return;
+    regfree(compiled);
+    delete compiled;
+}
+
+/** Pattern **/
+
+Pattern::Pattern(Kind kind, const string& pattern, const string& cwd):kind(kind), compiled(nullptr, freeRegex) {
+    if (kind == Regex) {
+        text = pattern;
+        auto regex = new regex_t;
+        int status = regcomp(regex, pattern.c_str(), REG_EXTENDED | REG_NOSUB);
+        if (status != 0) {
+            char message[256];
+            regerror(status, regex, message, sizeof(message));
+            delete regex;
+            throw toss_exception("bad regex " + pattern + ": " + message);
+        }
+        compiled.reset(regex);
+        literal = regexPrefix(pattern);
+        return;
+    }
+
+    text = pattern;
+    if (startsWith(text, "./")) text.erase(0, 2);
+    if (text.empty() || text[0] != '/') text = (cwd == "/" ? "" : cwd) + "/" + text;
+    for (rest = 0; rest < text.size() && strchr("*?[", text[rest]) == nullptr; ++rest) {
+        if (text[rest] == '\\' && rest + 1 < text.size()) ++rest;
+        literal += text[rest];
+    }
+}
+
+bool Pattern::matches(const string& path) const {
+    if (!startsWith(path, literal)) return false;
+    if (kind == Regex) return regexec(compiled.get(), path.c_str(), 0, nullptr, 0) == 0;
+    return globAt(text, rest, path, literal.size());
+}
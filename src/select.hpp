@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <regex.h>
+
+/**
+ * A pattern picking items of the recycle bin by the absolute path they were tossed from
+ * - Glob: "*" and "?" stay within a path component, "**" crosses them (and as a component of
+ *   its own also matches no directory at all), "[a-z]" and "[!a-z]" are classes, "\" escapes;
+ *   a relative glob is taken from cwd
+ * - Regex: POSIX extended, matching anywhere in the path unless anchored with "^"
+ * Both yield the literal text every match starts with, so the caller narrows a sorted index
+ * (or skips an entry with one compare) before any matching runs.
+ */
+class Pattern {
+public:
+    enum Kind { Glob, Regex };
+
+private:
+    Kind kind;
+    std::string text;
+    std::string literal;
+    size_t rest = 0;            // where the glob goes on after the literal prefix
+    std::unique_ptr<regex_t, void(*)(regex_t*)> compiled;
+
+public:
+    Pattern(Kind kind, const std::string& pattern, const std::string& cwd);
+
+    // every matching path starts with this
+    const std::string& prefix() const { return literal; }
+
+    bool matches(const std::string& path) const;
+};
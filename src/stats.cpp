@@ -0,0 +1,162 @@
+#include "stats.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <mutex>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <string_view>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+using namespace std;
+
+bool statsEnabled = false;
+
+// names of the phases open on this thread, outermost first
+static thread_local vector<const char*> openPhases;
+
+// one phase at one place in the tree, keyed by the names of the phases it ran in and its own
+struct PhaseTotal {
+    const char* name;
+    string parent;
+    uint64_t calls = 0;
+    int64_t nanos = 0;
+    int64_t first = 0;      // start of the first call, siblings are reported in that order
+};
+
+struct TraceEvent {
+    const char* name;
+    int64_t start;
+    int64_t duration;
+    long tid;
+};
+
+static mutex statsLock;
+static int64_t statsStart = 0;
+static bool printSummary = false;
+static string traceFile;
+// by name rather than by pointer, the same literal in two files may be two copies
+static map<string, PhaseTotal> phases;
+static map<string_view, uint64_t> counters;
+static vector<TraceEvent> events;
+
+int64_t statsNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static long threadId() {
+    thread_local long tid = syscall(SYS_gettid);
+    return tid;
+}
+
+static string millis(int64_t nanos) {
+    ostringstream out;
+    out << fixed << setprecision(2) << nanos / 1e6 << "ms";
+    return out.str();
+}
+
+static void printPhases(ostringstream& out, const map<string, vector<const PhaseTotal*>>& children, const string& parent, int depth, int64_t wall) {
+    auto found = children.find(parent);
+    if (found == children.end()) return;
+    vector<const PhaseTotal*> ordered = found->second;
+    sort(ordered.begin(), ordered.end(), [](const PhaseTotal* x, const PhaseTotal* y) {return x->first < y->first;});
+    for (const PhaseTotal* phase: ordered) {
+        string name = string(2 * depth, ' ') + phase->name;
+        out << left << setw(40) << name << right << setw(10) << phase->calls << setw(14) << millis(phase->nanos)
+            << setw(8) << fixed << setprecision(1) << (wall > 0 ? 100.0 * phase->nanos / wall : 0) << "%" << endl;
+        printPhases(out, children, phase->parent + phase->name + "\n", depth + 1, wall);
+    }
+}
+
+static void printStats(int64_t wall) {
+    map<string, vector<const PhaseTotal*>> children;
+    for (const auto& phase: phases) children[phase.second.parent].push_back(&phase.second);
+
+    ostringstream out;
+    out << "toss stats: " << millis(wall) << " in total" << endl;
+    out << left << setw(40) << "Phase" << right << setw(10) << "Calls" << setw(14) << "Time" << setw(9) << "Share" << endl;
+    printPhases(out, children, "", 0, wall);
+    if (!counters.empty()) {
+        out << endl << left << setw(40) << "Counter" << right << setw(10) << "Count" << endl;
+        for (const auto& counter: counters) out << left << setw(40) << counter.first << right << setw(10) << counter.second << endl;
+    }
+    cerr << out.str();
+}
+
+static void writeTrace(int64_t end) {
+    ofstream out(traceFile);
+    if (!out) {
+        cerr << "toss error: cannot write trace to " << traceFile << endl;
+        return;
+    }
+    long pid = getpid();
+    out << fixed << setprecision(3) << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << endl;
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"args\":{\"name\":\"toss\"}}";
+    for (const auto& event: events) {
+        out << "," << endl << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << event.tid
+            << ",\"ts\":" << (event.start - statsStart) / 1e3 << ",\"dur\":" << event.duration / 1e3 << "}";
+    }
+    for (const auto& counter: counters) {
+        out << "," << endl << "{\"name\":\"" << counter.first << "\",\"ph\":\"C\",\"pid\":" << pid
+            << ",\"ts\":" << (end - statsStart) / 1e3 << ",\"args\":{\"count\":" << counter.second << "}}";
+    }
+    out << endl << "]}" << endl;
+}
+
+static void reportStats() {
+    int64_t end = statsNow();
+    lock_guard<mutex> guard(statsLock);
+    statsEnabled = false;
+    if (printSummary) printStats(end - statsStart);
+    if (!traceFile.empty()) writeTrace(end);
+}
+
+void enableStats(bool summary, const string& tracePath, int64_t since) {
+    statsStart = since;
+    printSummary = summary;
+    traceFile = tracePath;
+    statsEnabled = true;
+    atexit(reportStats);
+}
+
+void recordPhase(const char* name, int64_t start) {
+    int64_t end = statsNow();
+    long tid = threadId();
+    string parent;
+    for (const char* open: openPhases) {
+        parent += open;
+        parent += '\n';
+    }
+    lock_guard<mutex> guard(statsLock);
+    if (!statsEnabled) return;
+    auto found = phases.find(parent + name);
+    if (found == phases.end()) {
+        found = phases.emplace(parent + name, PhaseTotal{name, parent}).first;
+        found->second.first = start;
+    }
+    ++found->second.calls;
+    found->second.nanos += end - start;
+    if (!traceFile.empty()) events.push_back({name, start, end - start, tid});
+}
+
+int64_t beginPhase(const char* name) {
+    openPhases.push_back(name);
+    return statsNow();
+}
+
+void endPhase(int64_t start) {
+    const char* name = openPhases.back();
+    openPhases.pop_back();
+    recordPhase(name, start);
+}
+
+void addCount(const char* name, uint64_t amount) {
+    lock_guard<mutex> guard(statsLock);
+    counters[name] += amount;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+/**
+ * Phase timers and counters behind --stats and --trace
+ * - a Phase times the block it is declared in, statsCount() adds to a named counter; while
+ *   stats are off either is a single test of statsEnabled, so they stay in the code for good
+ * - --stats prints on stderr, when toss exits, the time spent in each phase (summed over its
+ *   calls and threads) as a tree, a phase counted apart under every phase it ran in, and the
+ *   counters
+ * - --trace FILE writes every phase as a Chrome trace (chrome://tracing, ui.perfetto.dev)
+ * Phase and counter names must be string literals, only the pointers are kept.
+ */
+extern bool statsEnabled;
+
+// monotonic clock in nanoseconds
+int64_t statsNow();
+
+// start collecting, since is the statsNow() taken when the run started; the report is written
+// from an exit handler, so every way out of toss gets one
+void enableStats(bool summary, const std::string& tracePath, int64_t since);
+
+// a phase that ran from start until now, inside the phases open on the calling thread
+void recordPhase(const char* name, int64_t start);
+
+// open a phase on the calling thread and close the innermost one, see Phase
+int64_t beginPhase(const char* name);
+void endPhase(int64_t start);
+
+void addCount(const char* name, uint64_t amount);
+
+inline void statsCount(const char* name, uint64_t amount = 1) {
+    if (statsEnabled) addCount(name, amount);
+}
+
+class Phase {
+private:
+    int64_t start = 0;
+
+public:
+    explicit Phase(const char* name) {
+        if (statsEnabled) start = beginPhase(name);
+    }
+    ~Phase() { end(); }
+
+    // stop timing before the end of the block
+    void end() {
+        if (start != 0) {
+            endPhase(start);
+            start = 0;
+        }
+    }
+    Phase(const Phase&) = delete;
+    Phase& operator=(const Phase&) = delete;
+};
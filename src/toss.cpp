@@ -0,0 +1,41 @@
+#include "toss.hpp"
+
+#include <string.h>
+#include <sys/stat.h>
+using namespace std;
+
+void ensureMetaDir(const string& recycledir) {
+    string dir = recycledir + "/" + META_DIR;
+    if (mkdir(dir.c_str(), S_IRWXU) != 0 && errno != EEXIST) {
+        throw toss_exception("cannot create " + dir + ": " + strerror(errno));
+    }
+}
+
+void escapeField(string& out, string_view field) {
+    for (char c: field) {
+        if (c == '\t') out += "\\t";
+        else if (c == '\n') out += "\\n";
+        else if (c == '\\') out += "\\\\";
+        else out += c;
+    }
+}
+
+string unescapeField(const char* begin, const char* end) {
+    string out;
+    unescapeField(out, begin, end);
+    return out;
+}
+
+void unescapeField(string& out, const char* begin, const char* end) {
+    out.reserve(out.size() + (end - begin));
+    for (const char* c = begin; c < end; ++c) {
+        if (*c == '\\' && c + 1 < end) {
+            ++c;
+            if (*c == 't') out += '\t';
+            else if (*c == 'n') out += '\n';
+            else out += *c;
+        } else {
+            out += *c;
+        }
+    }
+}
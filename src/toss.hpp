@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+class toss_exception {
+private:
+    std::string msg;
+public:
+    toss_exception(std::string msg):msg(msg){}
+    const char* what() const { return msg.c_str(); }
+};
+
+// the user answered no to replacing a file, the batch was stopped where it was
+struct toss_canceled {};
+
+inline bool startsWith(const std::string& str, const std::string& prefix) {
+    return str.compare(0, prefix.size(), prefix) == 0;
+}
+
+// bookkeeping (catalog, bin registry, ...) lives in <recycledir>/.toss, never listed as tossed files
+constexpr const char* META_DIR = ".toss";
+
+inline std::string metaPath(const std::string& recycledir, const std::string& name) {
+    return recycledir + "/" + META_DIR + "/" + name;
+}
+
+// create <recycledir>/.toss if it is not there yet
+void ensureMetaDir(const std::string& recycledir);
+
+// tab separated records (catalog, journal) escape tabs, newlines and backslashes in paths
+void escapeField(std::string& out, std::string_view field);
+std::string unescapeField(const char* begin, const char* end);
+void unescapeField(std::string& out, const char* begin, const char* end);
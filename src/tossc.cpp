@@ -0,0 +1,174 @@
+// tossc: runs a toss command on a running tossd, or execs bin/toss when there is none
+// - built on its own and statically, with libc only: starting it costs a fraction of
+//   loading bin/toss and libstdc++, which is the point of handing the command over
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "daemon.hpp"
+#include "toss.hpp"
+
+extern char** environ;
+
+// the process running the command, signals the client gets are passed on to it
+static volatile pid_t server = 0;
+static volatile sig_atomic_t interrupted = 0;
+
+static void passSignal(int sig) {
+    interrupted = sig;
+    if (server > 0) kill(server, sig);
+}
+
+static bool writeAll(int fd, const void* data, size_t length) {
+    const char* p = static_cast<const char*>(data);
+    while (length > 0) {
+        ssize_t n = send(fd, p, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void* data, size_t length) {
+    char* p = static_cast<char*>(data);
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+// '\0' terminated strings appended to one growing buffer
+struct Request {
+    char* data = nullptr;
+    size_t length = 0;
+    size_t capacity = 0;
+
+    bool add(const char* text) {
+        size_t size = strlen(text) + 1;
+        if (length + size > capacity) {
+            capacity = (length + size) * 2;
+            data = static_cast<char*>(realloc(data, capacity));
+            if (data == nullptr) return false;
+        }
+        memcpy(data + length, text, size);
+        length += size;
+        return length <= TOSSD_MAX_REQUEST;
+    }
+};
+
+static bool buildRequest(int argc, char* argv[], Request& request) {
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == nullptr) return false;
+    mode_t mask = umask(0);
+    umask(mask);
+    char number[32];
+
+    if (!request.add(cwd)) return false;
+    snprintf(number, sizeof(number), "%u", unsigned(mask));
+    if (!request.add(number)) return false;
+    snprintf(number, sizeof(number), "%d", argc);
+    if (!request.add(number)) return false;
+    for (int i = 0; i < argc; ++i) {
+        if (!request.add(argv[i])) return false;
+    }
+    for (char** env = environ; *env != nullptr; ++env) {
+        if (!request.add(*env)) return false;
+    }
+    return true;
+}
+
+static int connectDaemon() {
+    const char* home = getenv("HOME");
+    if (home == nullptr || *home == '\0' || getenv("TOSS_DIRECT") != nullptr) return -1;
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    int length = snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/.recyclebin/%s/%s", home, META_DIR, TOSSD_SOCKET);
+    if (length < 0 || size_t(length) >= sizeof(addr.sun_path)) return -1;
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+    if (connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// the length goes with stdin, stdout and stderr; until it is sent the daemon has nothing to run
+static bool sendDescriptors(int sock, uint32_t length) {
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+    iovec iov = {&length, sizeof(length)};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof(length);
+}
+
+// bin/toss next to this program
+static void runDirect(char* argv[]) {
+    char path[PATH_MAX];
+    ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (n > 0) {
+        path[n] = '\0';
+        char* slash = strrchr(path, '/');
+        if (slash != nullptr && size_t(slash - path) + sizeof("/toss") <= sizeof(path)) {
+            strcpy(slash, "/toss");
+            execv(path, argv);
+        }
+    }
+    execvp("toss", argv);
+    fprintf(stderr, "toss error: cannot run toss: %s\n", strerror(errno));
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    int sock = connectDaemon();
+    Request request;
+    if (sock < 0 || !buildRequest(argc, argv, request) || !sendDescriptors(sock, request.length)) {
+        if (sock >= 0) close(sock);
+        runDirect(argv);
+    }
+
+    // from here on the command may be running, it is never run a second time
+    struct sigaction pass = {};
+    pass.sa_handler = passSignal;
+    for (int sig: {SIGINT, SIGTERM, SIGHUP, SIGQUIT}) sigaction(sig, &pass, nullptr);
+
+    int32_t pid = 0, status = 0;
+    if (writeAll(sock, request.data, request.length) && readAll(sock, &pid, sizeof(pid))) {
+        server = pid;
+        if (interrupted) kill(server, interrupted);
+        if (readAll(sock, &status, sizeof(status))) return status;
+    }
+
+    // killed by a signal passed on to it: go the same way
+    if (interrupted) {
+        signal(interrupted, SIG_DFL);
+        raise(interrupted);
+    }
+    fprintf(stderr, "toss error: tossd stopped before finishing the command\n");
+    return 1;
+}
@@ -0,0 +1,214 @@
+#include "transfer.hpp"
+#include "hash.hpp"
+
+#include <filesystem>
+#include <system_error>
+#include <cstdio>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+using namespace std;
+
+static void fail(const string& what, const string& path) {
+    throw filesystem::filesystem_error(what, path, error_code(errno, system_category()));
+}
+
+// closes the descriptor when the copy unwinds
+struct FileDescriptor {
+    int fd;
+    FileDescriptor(int fd):fd(fd){}
+    ~FileDescriptor() { if (fd >= 0) close(fd); }
+};
+
+string tempNameFor(const string& dest, pid_t pid) {
+    filesystem::path path(dest);
+    return (path.parent_path() / ("." + path.filename().string() + ".toss-" + to_string(pid))).string();
+}
+
+// copy [offset, offset + length) with copy_file_range, dropping to sendfile when the kernel refuses
+static void copyRange(int in, int out, off_t offset, off_t length, bool& useCopyRange, const string& src) {
+    while (length > 0) {
+        size_t chunk = min<off_t>(length, 1 << 30);
+        ssize_t n = -1;
+
+        if (useCopyRange) {
+            loff_t inOffset = offset, outOffset = offset;
+            n = copy_file_range(in, &inOffset, out, &outOffset, chunk, 0);
+            if (n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL)) {
+                useCopyRange = false;
+            }
+        }
+        if (!useCopyRange) {
+            if (lseek(out, offset, SEEK_SET) < 0) fail("cannot seek", src);
+            off_t inOffset = offset;
+            n = sendfile(out, in, &inOffset, chunk);
+        }
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail("cannot copy", src);
+        }
+        if (n == 0) break;   // source shrank underneath us, the size check catches it
+        offset += n;
+        length -= n;
+    }
+}
+
+// hash of everything in the file, read from its start
+static Hash128 contentHash(int fd, const string& path) {
+    if (lseek(fd, 0, SEEK_SET) < 0) fail("cannot seek", path);
+    uintmax_t size = 0;
+    return hashFd(fd, size);
+}
+
+void copyFile(const string& src, const string& dest) {
+    FileDescriptor in(open(src.c_str(), O_RDONLY | O_CLOEXEC));
+    if (in.fd < 0) fail("cannot open", src);
+
+    struct stat srcInfo;
+    if (fstat(in.fd, &srcInfo) != 0) fail("cannot stat", src);
+
+    string tmp = tempNameFor(dest);
+    FileDescriptor out(open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, srcInfo.st_mode & 07777));
+    if (out.fd < 0) fail("cannot create", tmp);
+
+    try {
+        // share extents outright where the filesystem allows it
+        bool reflinked = ioctl(out.fd, FICLONE, in.fd) == 0;
+        if (!reflinked) {
+            bool useCopyRange = true;
+            off_t end = srcInfo.st_size;
+            off_t data = 0;
+
+            // walk the data extents so holes in sparse files are skipped
+            while (data < end) {
+                off_t start = lseek(in.fd, data, SEEK_DATA);
+                if (start < 0) {
+                    if (errno == ENXIO) break;                  // only a hole left
+                    if (errno != EINVAL) fail("cannot seek", src);
+                    start = data;                               // no SEEK_DATA support, copy everything
+                }
+                off_t hole = lseek(in.fd, start, SEEK_HOLE);
+                if (hole < 0) hole = end;
+                copyRange(in.fd, out.fd, start, min(hole, end) - start, useCopyRange, src);
+                data = hole;
+            }
+            if (ftruncate(out.fd, end) != 0) fail("cannot size", tmp);
+        }
+
+        struct stat destInfo;
+        if (fstat(out.fd, &destInfo) != 0) fail("cannot stat", tmp);
+        if (destInfo.st_size != srcInfo.st_size) {
+            errno = EIO;
+            fail("copy is incomplete", tmp);
+        }
+
+        // keep ownership, permissions and times
+        if (fchown(out.fd, srcInfo.st_uid, srcInfo.st_gid) != 0 && errno != EPERM) fail("cannot chown", tmp);
+        fchmod(out.fd, srcInfo.st_mode & 07777);
+        struct timespec times[2] = {srcInfo.st_atim, srcInfo.st_mtim};
+        futimens(out.fd, times);
+
+        if (fsync(out.fd) != 0) fail("cannot sync", tmp);
+
+        // verify before the source is allowed to go away: the copy is read back from the disk
+        // (its cached pages dropped once synced) and its hash compared with the source's; a
+        // reflink shares the source's extents, so there is nothing to compare
+        if (!reflinked) {
+            posix_fadvise(out.fd, 0, 0, POSIX_FADV_DONTNEED);
+            FileDescriptor check(open(tmp.c_str(), O_RDONLY | O_CLOEXEC));
+            if (check.fd < 0) fail("cannot open", tmp);
+            Hash128 copied = contentHash(check.fd, tmp);
+            Hash128 original = contentHash(in.fd, src);
+            if (copied.lo != original.lo || copied.hi != original.hi) {
+                errno = EIO;
+                fail("copy does not match the source", tmp);
+            }
+        }
+        if (rename(tmp.c_str(), dest.c_str()) != 0) fail("cannot rename", tmp);
+    } catch (...) {
+        unlink(tmp.c_str());
+        throw;
+    }
+}
+
+// copy src (file, symlink or directory tree) to dest on another filesystem
+static void copyPath(const string& src, const string& dest) {
+    struct stat info;
+    if (lstat(src.c_str(), &info) != 0) fail("cannot stat", src);
+
+    if (S_ISREG(info.st_mode)) {
+        copyFile(src, dest);
+    } else if (S_ISLNK(info.st_mode)) {
+        char target[PATH_MAX];
+        ssize_t n = readlink(src.c_str(), target, sizeof(target) - 1);
+        if (n < 0) fail("cannot read link", src);
+        target[n] = '\0';
+        if (symlink(target, dest.c_str()) != 0) fail("cannot create link", dest);
+    } else if (S_ISDIR(info.st_mode)) {
+        if (mkdir(dest.c_str(), info.st_mode & 07777) != 0 && errno != EEXIST) fail("cannot create directory", dest);
+        for (const auto& entry: filesystem::directory_iterator(src)) {
+            copyPath(entry.path().string(), dest + "/" + entry.path().filename().string());
+        }
+        struct timespec times[2] = {info.st_atim, info.st_mtim};
+        utimensat(AT_FDCWD, dest.c_str(), times, AT_SYMLINK_NOFOLLOW);
+    } else {
+        errno = EOPNOTSUPP;
+        fail("cannot move special file across filesystems", src);
+    }
+}
+
+void movePath(const string& src, const string& dest) {
+    if (rename(src.c_str(), dest.c_str()) == 0) return;
+    if (errno != EXDEV) fail("cannot rename", src);
+
+    // different filesystems, the whole copy has to land before anything is removed
+    struct stat info;
+    if (lstat(src.c_str(), &info) != 0) fail("cannot stat", src);
+    if (S_ISDIR(info.st_mode)) {
+        // copied under a temporary name and renamed into place whole, so dest existing means
+        // the copy is complete (the journal relies on this when finishing an interrupted move)
+        error_code ec;
+        string tmp = tempNameFor(dest);
+        try {
+            copyPath(src, tmp);
+            if (rename(tmp.c_str(), dest.c_str()) != 0) fail("cannot rename", tmp);
+        } catch (...) {
+            filesystem::remove_all(tmp, ec);
+            throw;
+        }
+        filesystem::remove_all(src);
+    } else {
+        if (S_ISLNK(info.st_mode)) {
+            unlink(dest.c_str());
+        }
+        copyPath(src, dest);
+        if (unlink(src.c_str()) != 0) fail("cannot remove", src);
+    }
+}
+
+bool moveNoReplace(const string& src, const string& dest) {
+    struct stat info;
+    for (bool madeParent = false; ; madeParent = true) {
+        if (renameat2(AT_FDCWD, src.c_str(), AT_FDCWD, dest.c_str(), RENAME_NOREPLACE) == 0) return true;
+        if (errno == EEXIST) return false;
+        if (errno != ENOENT || madeParent) break;
+
+        // the missing part may be the source: no directories are made for a move that cannot happen
+        if (lstat(src.c_str(), &info) != 0) fail("cannot rename", src);
+        filesystem::create_directories(filesystem::path(dest).parent_path());
+    }
+    if (errno != EXDEV && errno != EINVAL) fail("cannot rename", src);
+
+    // another filesystem, or one without RENAME_NOREPLACE: checked first, then moved
+    if (lstat(dest.c_str(), &info) == 0) return false;
+    if (lstat(src.c_str(), &info) != 0) fail("cannot stat", src);
+    filesystem::create_directories(filesystem::path(dest).parent_path());
+    movePath(src, dest);
+    return true;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <string>
+#include <unistd.h>
+
+/**
+ * Move src to dest with rename(), and when they sit on different filesystems (EXDEV)
+ * copy the data across and unlink the source afterwards.
+ *
+ * The copy tries, in order:
+ * 1. FICLONE reflink, sharing extents when both paths live on the same btrfs/xfs pool
+ * 2. copy_file_range over each data extent (SEEK_DATA / SEEK_HOLE), so holes stay holes
+ * 3. sendfile for kernels or filesystems without copy_file_range
+ * Every copy is written to a temporary name, checked against the source size, fsynced, read
+ * back and hashed to check it against the source, and only then renamed into place and the
+ * source removed. Directories are copied entry by entry.
+ *
+ * Errors are thrown as filesystem::filesystem_error, the same as filesystem::rename.
+ */
+void movePath(const std::string& src, const std::string& dest);
+
+// movePath that leaves anything already at dest alone, false if something was in the way
+// - the check and the move are one renameat2(RENAME_NOREPLACE), nothing is stat'ed beforehand
+// - dest's parent directories are made only once the rename has found them missing
+bool moveNoReplace(const std::string& src, const std::string& dest);
+
+// copy a single regular file, used by movePath; dest is replaced atomically
+void copyFile(const std::string& src, const std::string& dest);
+
+// where process pid stages a copy for dest before renaming it into place
+std::string tempNameFor(const std::string& dest, pid_t pid = getpid());
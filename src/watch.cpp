@@ -0,0 +1,234 @@
+#include "watch.hpp"
+#include "toss.hpp"
+
+#include <iostream>
+#include <chrono>
+#include <set>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+using namespace std;
+using Clock = chrono::steady_clock;
+
+// a bin is reconciled once it has been quiet this long, or has had changes waiting this long
+constexpr int QUIET_MS = 200;
+constexpr int MAX_WAIT_MS = 2000;
+
+static constexpr uint32_t MIRRORED = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR | IN_DONT_FOLLOW;
+static constexpr uint32_t REMOVED = IN_DELETE | IN_MOVED_FROM | IN_ONLYDIR | IN_DONT_FOLLOW;
+static constexpr uint32_t STORE = IN_CREATE | IN_MOVED_TO | REMOVED;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stopWatching(int) {
+    stopping = 1;
+}
+
+// one bin being watched, directories are relative to the bin ("" is the bin itself)
+struct WatchedBin {
+    string bin;
+    Catalog& catalog;
+    int fd = -1;
+    unordered_map<int, string> dirs;
+    set<string> changed;
+    bool overflowed = false;
+    Clock::time_point first, last;
+
+    WatchedBin(const string& bin, Catalog& catalog):bin(bin), catalog(catalog){}
+    ~WatchedBin() { if (fd >= 0) close(fd); }
+
+    void watch(const string& dir, uint32_t mask);
+    void watchMirrored(const string& dir);
+    void watchStores();
+    void watchAll();
+    void handle(const inotify_event& event);
+    void reconcile();
+    void rescan();
+};
+
+void WatchedBin::watch(const string& dir, uint32_t mask) {
+    int wd = inotify_add_watch(fd, (bin + dir).c_str(), mask);
+    if (wd >= 0) {
+        dirs[wd] = dir;
+    } else if (errno == ENOSPC) {
+        throw toss_exception("too many directories to watch in " + bin + ", see fs.inotify.max_user_watches");
+    }
+}
+
+// dir and every directory below it, the bookkeeping directory aside
+void WatchedBin::watchMirrored(const string& dir) {
+    vector<string> pending{dir};
+    while (!pending.empty()) {
+        string current = move(pending.back());
+        pending.pop_back();
+        watch(current, MIRRORED);
+        DIR* listing = opendir((bin + current).c_str());
+        if (listing == nullptr) continue;
+        while (struct dirent* entry = readdir(listing)) {
+            if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN) continue;
+            string name = entry->d_name;
+            if (name == "." || name == ".." || (current.empty() && name == META_DIR)) continue;
+            string child = current + "/" + name;
+            struct stat info;
+            if (entry->d_type == DT_UNKNOWN && (lstat((bin + child).c_str(), &info) != 0 || !S_ISDIR(info.st_mode))) continue;
+            pending.push_back(child);
+        }
+        closedir(listing);
+    }
+}
+
+// .toss itself for the stores coming and going, the object shards and the tree store
+void WatchedBin::watchStores() {
+    string meta = string("/") + META_DIR;
+    watch(meta, STORE);
+    watch(meta + "/objects", STORE);
+    watch(meta + "/trees", REMOVED);
+    DIR* listing = opendir((bin + meta + "/objects").c_str());
+    if (listing == nullptr) return;
+    while (struct dirent* entry = readdir(listing)) {
+        if (entry->d_name[0] != '.') watch(meta + "/objects/" + entry->d_name, REMOVED);
+    }
+    closedir(listing);
+}
+
+void WatchedBin::watchAll() {
+    watchMirrored("");
+    watchStores();
+}
+
+void WatchedBin::handle(const inotify_event& event) {
+    if (event.mask & IN_Q_OVERFLOW) {
+        overflowed = true;
+        return;
+    }
+    if (event.mask & IN_IGNORED) {
+        dirs.erase(event.wd);
+        return;
+    }
+    auto it = dirs.find(event.wd);
+    if (it == dirs.end() || event.len == 0) return;
+    const string& dir = it->second;
+    string name = event.name;
+    string path = dir + "/" + name;
+    bool added = event.mask & (IN_CREATE | IN_MOVED_TO);
+    bool isDir = event.mask & IN_ISDIR;
+
+    string meta = string("/") + META_DIR;
+    if (dir.empty() && name == META_DIR) {
+        if (added) watchStores();
+        else changed.insert(path);
+    } else if (dir == meta) {
+        // only the stores, not the catalog, journals, locks and totals next to them
+        if (name != "objects" && name != "trees") return;
+        if (added) watchStores();
+        else changed.insert(path);
+    } else if (dir == meta + "/objects") {
+        if (added && isDir) watch(path, REMOVED);
+        else if (!added) changed.insert(path);
+    } else if (startsWith(dir, meta + "/")) {
+        // an object or a tree gone
+        changed.insert(path);
+    } else {
+        if (added && isDir) watchMirrored(path);
+        changed.insert(path);
+    }
+
+    last = Clock::now();
+    if (changed.size() == 1) first = last;
+}
+
+void WatchedBin::reconcile() {
+    vector<string> paths(changed.begin(), changed.end());
+    changed.clear();
+    size_t count = catalog.reconcile(paths);
+    if (count > 0) cout << "Updated " << count << " entries in the catalog of " << bin << "." << endl;
+}
+
+void WatchedBin::rescan() {
+    overflowed = false;
+    changed.clear();
+
+    // marked first, so a watcher killed during the rebuild leaves the next one to finish it
+    string mark = metaPath(bin, "rescan");
+    int markFd = open(mark.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (markFd >= 0) close(markFd);
+
+    // directories made while events were lost are watched before the rebuild looks
+    watchAll();
+    size_t count = catalog.rebuild();
+    unlink(mark.c_str());
+    cout << "Rescanned " << bin << " after losing track of its changes, " << count << " entries." << endl;
+}
+
+void watchBins(BinRegistry& bins) {
+    vector<unique_ptr<WatchedBin>> watched;
+    for (const auto& bin: bins.all()) {
+        auto state = make_unique<WatchedBin>(bin, bins.catalogFor(bin));
+        state->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (state->fd < 0) throw toss_exception(string("cannot watch ") + bin + ": " + strerror(errno));
+        ensureMetaDir(bin);
+        state->watchAll();
+        if (access(metaPath(bin, "rescan").c_str(), F_OK) == 0) state->rescan();
+        watched.push_back(move(state));
+    }
+    cout << "Watching " << watched.size() << (watched.size() == 1 ? " recycle bin." : " recycle bins.") << endl;
+
+    // no SA_RESTART, so a stop request interrupts poll()
+    struct sigaction stop = {};
+    stop.sa_handler = stopWatching;
+    sigaction(SIGINT, &stop, nullptr);
+    sigaction(SIGTERM, &stop, nullptr);
+
+    vector<pollfd> fds;
+    for (const auto& state: watched) fds.push_back({state->fd, POLLIN, 0});
+    alignas(inotify_event) char buf[1 << 16];
+
+    while (!stopping) {
+        // sleep until an event, or until the next bin with changes is due
+        int timeout = -1;
+        auto now = Clock::now();
+        for (const auto& state: watched) {
+            if (state->changed.empty()) continue;
+            auto due = min(state->last + chrono::milliseconds(QUIET_MS), state->first + chrono::milliseconds(MAX_WAIT_MS));
+            int wait = max<long>(0, chrono::duration_cast<chrono::milliseconds>(due - now).count());
+            timeout = timeout < 0 ? wait : min(timeout, wait);
+        }
+        if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) {
+            throw toss_exception(string("failed to wait for changes: ") + strerror(errno));
+        }
+
+        for (size_t i = 0; i < watched.size(); ++i) {
+            WatchedBin& state = *watched[i];
+            if (fds[i].revents & POLLIN) {
+                ssize_t n;
+                while ((n = read(state.fd, buf, sizeof(buf))) > 0) {
+                    for (char* p = buf; p < buf + n; ) {
+                        const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+                        state.handle(*event);
+                        p += sizeof(inotify_event) + event->len;
+                    }
+                }
+            }
+
+            now = Clock::now();
+            if (state.overflowed) {
+                state.rescan();
+            } else if (!state.changed.empty() && (now - state.last >= chrono::milliseconds(QUIET_MS) || now - state.first >= chrono::milliseconds(MAX_WAIT_MS))) {
+                state.reconcile();
+            }
+        }
+    }
+
+    // nothing noticed is left behind
+    for (const auto& state: watched) {
+        if (!state->changed.empty()) state->reconcile();
+    }
+}
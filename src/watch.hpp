@@ -0,0 +1,23 @@
+#pragma once
+#include "bins.hpp"
+
+/**
+ * toss --watch: keeps the catalogs in line with changes made to the recycle bins directly
+ * (rm inside ~/.recyclebin, a cron job deleting old files, files moved in by hand), so the
+ * listing, recover and purge paths can keep trusting them without ever rescanning a bin
+ * - one inotify instance per bin watches its mirrored directories, the object store and the
+ *   tree store; inotify is not recursive, so directories appearing later are added as their
+ *   events arrive
+ * - events are gathered until the bin has been quiet for a moment, then only the stored items
+ *   they name are looked up and fixed, see Catalog::reconcile()
+ * - tosses, recovers and purges hold the shard locks of every stored path they move or delete
+ *   (objects, trees and mirrored paths alike) until their records are written, so by the time
+ *   the watcher gets those locks their own changes are in the catalog and there is nothing to
+ *   fix, however long the batch took; moves into the stores are not even watched
+ * - a full event queue drops events, so the bin that overflowed is marked (.toss/rescan) and
+ *   rebuilt; the mark outlives a watcher killed meanwhile and the next one rebuilds first
+ * - in a directory tossed whole (.toss/trees/<id>) only the directory itself is watched, the
+ *   size of its entry is not recounted when something inside it changes
+ * Runs until SIGINT or SIGTERM.
+ */
+void watchBins(BinRegistry& bins);
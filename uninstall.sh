@@ -2,9 +2,16 @@
 
 # uninstall toss
 sudo rm /usr/local/bin/toss
+
+# remove the recycle bins on other mounts, then the home one that lists them
+if [ -f ~/.recyclebin/.toss/bins ]; then
+    while read -r bin; do
+        sudo rm -r "$bin"
+    done < ~/.recyclebin/.toss/bins
+fi
 sudo rm -r ~/.recyclebin
 
 # remove cron job
-croncmd="find ~/.recyclebin -mtime +30 -delete;"
-cronjob="0 0 * * * $croncmd"
-( crontab -l | grep -v -F "$croncmd" ) | crontab -
\ No newline at end of file
+oldcmd="find ~/recyclebin -mtime +30 -delete;"
+croncmd="/usr/local/bin/toss --purge --older-than 30 > /dev/null;"
+( crontab -l | grep -v -F "$oldcmd" | grep -v -F "$croncmd" ) | crontab -
\ No newline at end of file